@@ -9,25 +9,118 @@
 #include <cstring>
 #include <exception>
 #include <new>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define LEAK_TESTER_BACKTRACE 1
+#define LEAK_TESTER_NOINLINE __attribute__((noinline))
+#else
+#define LEAK_TESTER_NOINLINE
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define LEAK_TESTER_PAGE_GUARD 1
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define LEAK_TESTER_FUNCTION __builtin_FUNCTION()
+#else
+#define LEAK_TESTER_FUNCTION ""
+#endif
 
 #define INCLUDE_NOTIFICATIONS  __Tester__::notifications = true
 // #define EXCLUDE_NOTIFICATIONS __Tester__::notifications = false
  
 #define FILE_OUTPUT(name) __Tester__::redirect_output(#name)
 #define SCREEN_OUTPUT __Tester__::redirect_output(0)
+// Record up to depth return addresses for every every-th allocation of a
+// thread; leaks are then grouped by call stack in the final report.
+#define STACK_TRACES(depth, every) \
+  (__Tester__::stack_depth = (depth), __Tester__::stack_sample = (every))
+// Sample memory occupation every every-th allocation or period_us
+// microseconds and snapshot the top allocation sites on each new peak;
+// written to name (.json or CSV) at exit.
+#define TIMELINE(every, period_us, name) \
+  __Tester__::start_timeline((every), (period_us), #name)
+// Surround new allocations with canaries (CANARY_GUARD) or end them at a
+// protected page (PAGE_GUARD); with check_every > 0 all canaries are also
+// verified every check_every-th allocation. NO_GUARD switches back.
+#define GUARD_MODE(mode, check_every) \
+  (__Tester__::guard_mode = __Tester__::mode, __Tester__::canary_period = (check_every))
+#define CHECK_CANARIES __Tester__::check_canaries()
 
 namespace __Tester__ {
   typedef unsigned long ULong; 
   struct Info {
     void *address;
-    long line;
     std::size_t _size;
-    bool isArray;
     Info *link;
-  } *alloc_map(0);
-  int alloc_count(0), dealloc_count(0);
-  long alloc_total(0), dealloc_total(0), alloc_current(0), 
-    alloc_max(0);
+    unsigned site;            // index into the site registry, 0 if internal
+    unsigned stack;
+    bool isArray;
+    unsigned char alignment;  // log2 of the requested alignment, 0 if none
+    unsigned char guard;      // GuardMode the block was allocated with
+  };
+  // Allocation map: a chained hash table keyed by address. Buckets and
+  // Info nodes come from std::malloc (never from the overridden operator
+  // new), and released nodes are recycled through a free list, so keeping
+  // track of an allocation costs O(1) regardless of how many are live.
+  // The map is split into SHARDS independently locked tables picked by the
+  // high bits of the address hash, so threads rarely contend on a lock.
+  struct Map {
+    std::mutex lock;
+    Info **buckets = 0;
+    std::size_t mask = 0, count = 0;
+    Info *free_nodes = 0;
+  };
+  const std::size_t SHARDS(64), INITIAL_BUCKETS(64), NODES_PER_BLOCK(256);
+  Map alloc_map[SHARDS];
+  // Allocation statistics are kept per thread and only summed up by the
+  // report; each block is written by its owning thread alone and outlives
+  // it, so counts from finished threads are not lost. Current and peak
+  // occupation have to be global to make the peak meaningful.
+  struct Counters {
+    std::atomic<long> alloc_count, dealloc_count, alloc_total, dealloc_total;
+    Counters *link;
+  };
+  std::atomic<Counters*> all_counters(0);
+  thread_local Counters *local_counters(0);
+  std::atomic<long> alloc_current(0), alloc_max(0);
+  // Captured call stacks are interned once and referred to by index from
+  // every Info, so a stack costs one word per allocation. Index 0 means no
+  // stack was recorded (tracing off or the allocation was not sampled).
+  const int MAX_STACK_DEPTH(32);
+  struct Stack {
+    std::size_t hash;
+    unsigned index;
+    int depth;
+    void *frames[MAX_STACK_DEPTH];
+    Stack *link;
+  };
+  struct Stacks {
+    std::mutex lock;
+    Stack **buckets = 0, **by_index = 0;
+    std::size_t mask = 0, count = 0;
+  } stacks;
+  int stack_depth(0), stack_sample(1);
+  thread_local int stack_countdown(0);
+  // Allocation sites: LEAK_NEW (or new, with LEAK_TESTER_NEW_MACRO) passes
+  // (file, line, function) to the operator new overloads below, which
+  // register it and keep its index. Index 0 stands for allocations made
+  // without them (the standard library, code included earlier), reported
+  // as internal.
+  struct Site {
+    const char *file, *function;
+    int line;
+  };
+  struct Sites {
+    std::mutex lock;
+    Site *by_index = 0;
+    unsigned *slots = 0;
+    std::size_t mask = 0, count = 0;
+  } sites;
   bool notifications(false);
   char previous_name[1000] = "";
   FILE *output(stdout);
@@ -42,53 +135,607 @@ namespace __Tester__ {
     }
     output = stdout;
   }
-  void *Alloc(long line, std::size_t _size, bool isArray) {
-    void *address(std::malloc(_size));
-    if(!address) throw std::bad_alloc();
-    if(line != -1) {
-      alloc_count++;
-      alloc_total += _size; alloc_current += _size;
-      if(alloc_current > alloc_max) alloc_max = alloc_current;
-      if(notifications) {
-        if(line == -2) std::fprintf(output, ">>> Internally allocated ");
-        else std::fprintf(output, ">>> in %ld. line of the script we have allocated memory with the line: ", line);
-        std::fprintf(output, "%lu bytes, on address %p\n", (ULong)_size, address);
+  Counters &Local() {
+    if(!local_counters) {
+      void *block(std::malloc(sizeof(Counters)));
+      if(!block) throw std::bad_alloc();
+      local_counters = new(block) Counters();
+      local_counters->link = all_counters.load();
+      while(!all_counters.compare_exchange_weak(local_counters->link, local_counters));
+    }
+    return *local_counters;
+  }
+  // Only the owning thread writes its counters, so a relaxed load/store
+  // pair is enough and avoids a locked instruction per allocation.
+  void Add(std::atomic<long> &counter, long value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, 
+      std::memory_order_relaxed);
+  }
+  // Returns true if this change raised the peak.
+  bool Occupy(long value) {
+    long current(alloc_current.fetch_add(value, std::memory_order_relaxed) + value),
+      peak(alloc_max.load(std::memory_order_relaxed));
+    while(current > peak)
+      if(alloc_max.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+        return true;
+    return false;
+  }
+  long long Now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  struct Totals {
+    long alloc_count, dealloc_count, alloc_total, dealloc_total;
+  };
+  Totals Sum() {
+    Totals totals = {0, 0, 0, 0};
+    for(Counters *current = all_counters.load(); current; current = current->link) {
+      totals.alloc_count += current->alloc_count.load(std::memory_order_relaxed);
+      totals.dealloc_count += current->dealloc_count.load(std::memory_order_relaxed);
+      totals.alloc_total += current->alloc_total.load(std::memory_order_relaxed);
+      totals.dealloc_total += current->dealloc_total.load(std::memory_order_relaxed);
+    }
+    return totals;
+  }
+  std::size_t Hash(const void *address) {
+    std::size_t key((std::size_t)address);
+    key ^= key >> 33; key *= (std::size_t)0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+  }
+  Map &Shard(std::size_t hash) {
+    return alloc_map[(hash >> 48) & (SHARDS - 1)];
+  }
+  // The helpers below expect the shard's lock to be held.
+  Info *NewInfo(Map &shard) {
+    if(!shard.free_nodes) {
+      Info *block((Info*)std::malloc(NODES_PER_BLOCK * sizeof(Info)));
+      if(!block) throw std::bad_alloc();
+      for(std::size_t i = 0; i < NODES_PER_BLOCK; i++) {
+        block[i].link = shard.free_nodes; shard.free_nodes = block + i;
       }
     }
-    Info info = {address, line, _size, isArray, alloc_map};
-    if(!(alloc_map = (Info*)std::malloc(sizeof(Info)))) 
-       throw std::bad_alloc(); 
-    *alloc_map = info;
-    return address;
+    Info *info(shard.free_nodes);
+    shard.free_nodes = info->link;
+    return info;
   }
-  void Dealloc(void *ptr, bool isArray) {
-    Info *current(alloc_map), *previous(0);
-    for(; current && current->address != ptr; current = current->link)
-      previous = current;           
-    if(current) {
-      if(current->line != -1) {
-        std::size_t _size(current->_size);
-        dealloc_count++;
-        dealloc_total += _size; alloc_current -= _size;
-        if(notifications) {
-          std::fprintf(output, ">>> Releasing %lu bytes on address %p\n", 
-            (ULong)_size, ptr);
+  void Rehash(Map &shard, std::size_t capacity) {
+    Info **buckets((Info**)std::calloc(capacity, sizeof(Info*)));
+    if(!buckets) throw std::bad_alloc();
+    if(shard.buckets) {
+      for(std::size_t i = 0; i <= shard.mask; i++)
+        for(Info *current = shard.buckets[i], *next; current; current = next) {
+          next = current->link;
+          Info *&head(buckets[Hash(current->address) & (capacity - 1)]);
+          current->link = head; head = current;
         }
-        if(isArray != current->isArray)
-          std::fprintf(output, "*** ERROR: Releasing on address %p %s "
-            "should be done with delete[]!\n", 
-            ptr, isArray ? "no" : "yes");
+      std::free(shard.buckets);
+    }
+    shard.buckets = buckets; shard.mask = capacity - 1;
+  }
+  void Insert(Map &shard, std::size_t hash, const Info &info) {
+    if(!shard.buckets) Rehash(shard, INITIAL_BUCKETS);
+    else if(shard.count > shard.mask) Rehash(shard, 2 * (shard.mask + 1));
+    Info *node(NewInfo(shard)), *&head(shard.buckets[hash & shard.mask]);
+    *node = info; node->link = head; head = node;
+    shard.count++;
+  }
+  // Returns the link that points to the entry for address, so the caller
+  // can unlink it; null if the address is not tracked.
+  Info **Find(Map &shard, std::size_t hash, const void *address) {
+    if(!shard.buckets) return 0;
+    Info **link(&shard.buckets[hash & shard.mask]);
+    for(; *link; link = &(*link)->link)
+      if((*link)->address == address) return link;
+    return 0;
+  }
+  bool Tracked(const void *address) {
+    std::size_t hash(Hash(address));
+    Map &shard(Shard(hash));
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return Find(shard, hash, address) != 0;
+  }
+  void Erase(Map &shard, Info **link) {
+    Info *current(*link);
+    *link = current->link;
+    current->link = shard.free_nodes; shard.free_nodes = current;
+    shard.count--;
+  }
+  // Expects stacks.lock to be held.
+  void GrowStacks(std::size_t capacity) {
+    Stack **buckets((Stack**)std::calloc(capacity, sizeof(Stack*))),
+      **by_index((Stack**)std::realloc(stacks.by_index, capacity * sizeof(Stack*)));
+    if(!buckets || !by_index) throw std::bad_alloc();
+    stacks.by_index = by_index;
+    for(std::size_t i = 0; i < stacks.count; i++) {
+      Stack *&head(buckets[stacks.by_index[i]->hash & (capacity - 1)]);
+      stacks.by_index[i]->link = head; head = stacks.by_index[i];
+    }
+    std::free(stacks.buckets);
+    stacks.buckets = buckets; stacks.mask = capacity - 1;
+  }
+  unsigned Intern(void *const frames[], int depth) {
+    std::size_t hash(14695981039346656037ULL);
+    for(int i = 0; i < depth; i++) 
+      hash = (hash ^ (std::size_t)frames[i]) * 1099511628211ULL;
+    std::lock_guard<std::mutex> guard(stacks.lock);
+    if(stacks.buckets)
+      for(Stack *current = stacks.buckets[hash & stacks.mask]; current; 
+        current = current->link)
+        if(current->hash == hash && current->depth == depth &&
+          !std::memcmp(current->frames, frames, depth * sizeof(void*))) 
+          return current->index;
+    if(!stacks.buckets || stacks.count > stacks.mask) GrowStacks(stacks.buckets ? 2 * (stacks.mask + 1) : 256);
+    Stack *stack((Stack*)std::malloc(sizeof(Stack)));
+    if(!stack) throw std::bad_alloc();
+    stack->hash = hash; stack->depth = depth; stack->index = stacks.count + 1;
+    std::memcpy(stack->frames, frames, depth * sizeof(void*));
+    Stack *&head(stacks.buckets[hash & stacks.mask]);
+    stack->link = head; head = stack;
+    stacks.by_index[stacks.count++] = stack;
+    return stacks.count;
+  }
+  // Skips its own frame and Alloc's, so the stack starts at operator new.
+  LEAK_TESTER_NOINLINE unsigned CaptureStack() {
+#ifdef LEAK_TESTER_BACKTRACE
+    if(stack_depth <= 0 || --stack_countdown > 0) return 0;
+    stack_countdown = stack_sample;
+    void *frames[MAX_STACK_DEPTH + 2];
+    int depth(backtrace(frames, (stack_depth < MAX_STACK_DEPTH ? 
+      stack_depth : MAX_STACK_DEPTH) + 2) - 2);
+    return depth > 0 ? Intern(frames + 2, depth) : 0;
+#else
+    return 0;
+#endif
+  }
+  const Stack *FindStack(unsigned index) {
+    std::lock_guard<std::mutex> guard(stacks.lock);
+    return index ? stacks.by_index[index - 1] : 0;
+  }
+  std::size_t HashSite(const char *file, int line, const char *function) {
+    std::size_t hash(14695981039346656037ULL ^ (std::size_t)line);
+    for(; *file; file++) hash = (hash ^ (unsigned char)*file) * 1099511628211ULL;
+    for(; *function; function++) hash = (hash ^ (unsigned char)*function) * 1099511628211ULL;
+    return hash;
+  }
+  // The same site compiled into several template instances or
+  // translation units gets the same index.
+  unsigned InternSite(const char *file, int line, const char *function) {
+    std::size_t hash(HashSite(file, line, function));
+    std::lock_guard<std::mutex> guard(sites.lock);
+    if(2 * sites.count >= sites.mask) {
+      std::size_t capacity(sites.slots ? 2 * (sites.mask + 1) : 256);
+      unsigned *slots((unsigned*)std::calloc(capacity, sizeof(unsigned)));
+      Site *by_index((Site*)std::realloc(sites.by_index, capacity / 2 * sizeof(Site)));
+      if(!slots || !by_index) throw std::bad_alloc();
+      sites.by_index = by_index;
+      for(std::size_t i = 0; i < sites.count; i++) {
+        Site &site(sites.by_index[i]);
+        std::size_t slot(HashSite(site.file, site.line, site.function));
+        while(slots[slot & (capacity - 1)]) slot++;
+        slots[slot & (capacity - 1)] = i + 1;
+      }
+      std::free(sites.slots);
+      sites.slots = slots; sites.mask = capacity - 1;
+    }
+    for(;; hash++) {
+      unsigned &index(sites.slots[hash & sites.mask]);
+      if(!index) {
+        Site site = {file, function, line};
+        sites.by_index[sites.count] = site;
+        return index = ++sites.count;
+      }
+      Site &site(sites.by_index[index - 1]);
+      if(site.line == line && !std::strcmp(site.file, file) && 
+        !std::strcmp(site.function, function)) return index;
+    }
+  }
+  Site FindSite(unsigned index) {
+    std::lock_guard<std::mutex> guard(sites.lock);
+    Site none = {"", "", 0};
+    return index ? sites.by_index[index - 1] : none;
+  }
+  // The index of a site. A thread allocating from one site over and over,
+  // as in a loop, finds it again without the registry's lock.
+  unsigned SiteOf(const char *file, int line, const char *function) {
+    thread_local const char *last_file(0), *last_function(0);
+    thread_local int last_line(0);
+    thread_local unsigned last_site(0);
+    if(file != last_file || line != last_line || function != last_function) {
+      last_site = InternSite(file, line, function);
+      last_file = file; last_line = line; last_function = function;
+    }
+    return last_site;
+  }
+  // Live allocations that share an allocation site and call stack are
+  // reported as one group, largest groups first.
+  struct Group {
+    unsigned site;
+    unsigned stack;
+    long count;
+    std::size_t bytes;
+    void *example;
+  };
+  int CompareGroups(const void *first, const void *second) {
+    std::size_t a(((const Group*)first)->bytes), b(((const Group*)second)->bytes);
+    return a < b ? 1 : a > b ? -1 : 0;
+  }
+  // Expects the locks of all shards to be held.
+  std::size_t GroupAllocations(Group *&groups, std::size_t live) {
+    std::size_t capacity(1);
+    while(capacity < 2 * live) capacity *= 2;
+    if(!(groups = (Group*)std::calloc(capacity, sizeof(Group)))) return 0;
+    for(std::size_t j = 0; j < SHARDS; j++) {
+      Map &shard(alloc_map[j]);
+      for(std::size_t i = 0; shard.buckets && i <= shard.mask; i++)
+      for(Info *current = shard.buckets[i]; current; current = current->link) {
+        std::size_t slot(Hash((void*)((std::size_t)current->site << 32 | current->stack)));
+        for(;; slot++) {
+          Group &group(groups[slot & (capacity - 1)]);
+          if(!group.count) {
+            group.site = current->site; group.stack = current->stack;
+            group.example = current->address;
+          }
+          else if(group.site != current->site || group.stack != current->stack) 
+            continue;
+          group.count++; group.bytes += current->_size;
+          break;
+        }
+      }
+    }
+    std::size_t count(0);
+    for(std::size_t i = 0; i < capacity; i++)
+      if(groups[i].count) groups[count++] = groups[i];
+    std::qsort(groups, count, sizeof(Group), CompareGroups);
+    return count;
+  }
+  void PrintStack(unsigned index) {
+    const Stack *stack(FindStack(index));
+    if(!stack) return;
+#ifdef LEAK_TESTER_BACKTRACE
+    char **symbols(backtrace_symbols(stack->frames, stack->depth));
+    for(int i = 0; i < stack->depth; i++)
+      std::fprintf(output, "     #%d %s\n", i, symbols ? symbols[i] : "?");
+    std::free(symbols);
+#endif
+  }
+  // Timeline mode: every timeline_every-th allocation (or, with a period,
+  // the first allocation at least timeline_period microseconds after the
+  // previous sample) stores the current occupation in a ring buffer. Each
+  // time the peak grows by more than 1/16 over the last snapshot, the
+  // heaviest live allocation groups are recorded too. Both are written to
+  // timeline.name at exit, as JSON if the name ends in .json, else as CSV.
+  const std::size_t TIMELINE_SAMPLES(4096), TOP_SITES(8);
+  struct Sample {
+    long tick;
+    long long time;
+    long current, peak;
+  };
+  struct Snapshot {
+    long tick;
+    long long time;
+    long peak;
+    std::size_t count;
+    Group sites[TOP_SITES];
+  };
+  struct Timeline {
+    std::mutex lock;
+    std::atomic<long> ticks{0};
+    // last and next_snapshot are written under lock but read without
+    // it on every allocation, so they are atomic.
+    long long start = 0;
+    std::atomic<long long> last{0};
+    Sample *samples = 0;
+    std::size_t recorded = 0;
+    Snapshot *snapshots = 0;
+    std::size_t count = 0, capacity = 0;
+    std::atomic<long> next_snapshot{0};
+    char name[1000] = "";
+  } timeline;
+  std::atomic<long> timeline_every(0), timeline_period(0);
+  void start_timeline(long every, long period, const char name[]) {
+    std::lock_guard<std::mutex> guard(timeline.lock);
+    std::strncpy(timeline.name, name, sizeof(timeline.name) - 1);
+    timeline.start = Now(); timeline.last = timeline.start;
+    timeline_period = period; timeline_every = every > 0 ? every : 1;
+  }
+  void TakeSample(long tick, long long time) {
+    std::lock_guard<std::mutex> guard(timeline.lock);
+    if(!timeline.samples && !(timeline.samples = 
+      (Sample*)std::malloc(TIMELINE_SAMPLES * sizeof(Sample)))) return;
+    Sample sample = {tick, time - timeline.start, alloc_current.load(), alloc_max.load()};
+    timeline.samples[timeline.recorded++ % TIMELINE_SAMPLES] = sample;
+    timeline.last = time;
+  }
+  void TakeSnapshot(long peak) {
+    // Grouped before timeline.lock is taken, so that no thread holds more
+    // than SHARDS locks at once (ThreadSanitizer tracks no more than 64).
+    std::size_t live(0);
+    for(std::size_t j = 0; j < SHARDS; j++) {
+      alloc_map[j].lock.lock(); live += alloc_map[j].count;
+    }
+    Group *groups(0);
+    std::size_t count(GroupAllocations(groups, live));
+    for(std::size_t j = 0; j < SHARDS; j++) alloc_map[j].lock.unlock();
+    std::lock_guard<std::mutex> guard(timeline.lock);
+    if(peak < timeline.next_snapshot) { std::free(groups); return; }
+    timeline.next_snapshot = peak + peak / 16 + 1;
+    if(timeline.count == timeline.capacity) {
+      std::size_t capacity(timeline.capacity ? 2 * timeline.capacity : 32);
+      Snapshot *snapshots((Snapshot*)std::realloc(timeline.snapshots, 
+        capacity * sizeof(Snapshot)));
+      if(!snapshots) { std::free(groups); return; }
+      timeline.snapshots = snapshots; timeline.capacity = capacity;
+    }
+    Snapshot &snapshot(timeline.snapshots[timeline.count++]);
+    snapshot.tick = timeline.ticks.load(); snapshot.time = Now() - timeline.start;
+    snapshot.peak = peak;
+    snapshot.count = count < TOP_SITES ? count : TOP_SITES;
+    std::memcpy(snapshot.sites, groups, snapshot.count * sizeof(Group));
+    std::free(groups);
+  }
+  void Record(long every, bool peaked) {
+    long tick(timeline.ticks.fetch_add(1, std::memory_order_relaxed) + 1);
+    if(peaked) {
+      long peak(alloc_max.load(std::memory_order_relaxed));
+      if(peak >= timeline.next_snapshot.load(std::memory_order_relaxed)) 
+        TakeSnapshot(peak);
+    }
+    long period(timeline_period.load(std::memory_order_relaxed));
+    if(tick % every == 0) TakeSample(tick, Now());
+    else if(period) {
+      long long time(Now());
+      if(time - timeline.last.load(std::memory_order_relaxed) >= period) 
+        TakeSample(tick, time);
+    }
+  }
+  void WriteFrames(FILE *file, unsigned index) {
+    const Stack *stack(FindStack(index));
+    for(int i = 0; stack && i < stack->depth; i++)
+      std::fprintf(file, "%s\"%p\"", i ? ", " : "", stack->frames[i]);
+  }
+  void WriteTimeline() {
+    std::lock_guard<std::mutex> guard(timeline.lock);
+    FILE *file(std::fopen(timeline.name, "w"));
+    if(!file) return;
+    std::size_t length(std::strlen(timeline.name)), 
+      first(timeline.recorded > TIMELINE_SAMPLES ? timeline.recorded - TIMELINE_SAMPLES : 0);
+    bool json(length >= 5 && !std::strcmp(timeline.name + length - 5, ".json"));
+    if(json) std::fprintf(file, "{\"samples\": [");
+    else std::fprintf(file, "kind,tick,time_us,current,peak,rank,file,line,function,"
+      "stack,count,bytes\n");
+    for(std::size_t i = first; i < timeline.recorded; i++) {
+      Sample &sample(timeline.samples[i % TIMELINE_SAMPLES]);
+      if(json) std::fprintf(file, "%s\n  {\"tick\": %ld, \"time_us\": %lld, \"current\": %ld, "
+        "\"peak\": %ld}", i > first ? "," : "", sample.tick, sample.time, 
+        sample.current, sample.peak);
+      else std::fprintf(file, "sample,%ld,%lld,%ld,%ld,,,,,,,\n", sample.tick, sample.time, 
+        sample.current, sample.peak);
+    }
+    if(json) std::fprintf(file, "\n], \"peaks\": [");
+    for(std::size_t i = 0; i < timeline.count; i++) {
+      Snapshot &snapshot(timeline.snapshots[i]);
+      if(json) std::fprintf(file, "%s\n  {\"tick\": %ld, \"time_us\": %lld, \"peak\": %ld, "
+        "\"sites\": [", i ? "," : "", snapshot.tick, snapshot.time, snapshot.peak);
+      for(std::size_t j = 0; j < snapshot.count; j++) {
+        Group &group(snapshot.sites[j]);
+        Site site(FindSite(group.site));
+        if(json) {
+          std::fprintf(file, "%s\n    {\"file\": \"%s\", \"line\": %d, \"function\": \"%s\", "
+            "\"stack\": %u, \"count\": %ld, \"bytes\": %lu, \"frames\": [", j ? "," : "", 
+            site.file, site.line, site.function, group.stack, group.count, (ULong)group.bytes);
+          WriteFrames(file, group.stack);
+          std::fprintf(file, "]}");
+        }
+        else std::fprintf(file, "site,%ld,%lld,,%ld,%lu,%s,%d,%s,%u,%ld,%lu\n", snapshot.tick, 
+          snapshot.time, snapshot.peak, (ULong)j + 1, site.file, site.line, site.function, 
+          group.stack, group.count, (ULong)group.bytes);
+      }
+      if(json) std::fprintf(file, "]}");
+    }
+    if(json) std::fprintf(file, "\n]}\n");
+    std::fclose(file);
+  }
+  unsigned char Log2(std::size_t alignment) {
+    unsigned char log2(0);
+    while(alignment >>= 1) log2++;
+    return log2;
+  }
+  // Overrun detection. CANARY_GUARD puts a red zone filled with a known
+  // byte pattern in front of and behind the block and checks both when the
+  // block is released (or in batch by check_canaries). PAGE_GUARD maps the
+  // block so that it ends right before a PROT_NONE page, so the first
+  // write past the end faults on the offending instruction; the few bytes
+  // of padding needed for alignment are checked like a canary. Page guards
+  // need mmap and alignments up to the page size, otherwise canaries are
+  // used. Every Info remembers its mode, so the mode may change at any time.
+  enum GuardMode { NO_GUARD, CANARY_GUARD, PAGE_GUARD };
+  GuardMode guard_mode(NO_GUARD);
+  long canary_period(0);
+  std::atomic<long> canary_ticks(0);
+  const std::size_t RED_ZONE(16), MIN_ALIGNMENT(16);
+  const unsigned char CANARY(0xCA);
+  std::size_t RoundUp(std::size_t value, std::size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+  }
+  std::size_t PageSize() {
+#ifdef LEAK_TESTER_PAGE_GUARD
+    static const std::size_t page(sysconf(_SC_PAGESIZE));
+    return page;
+#else
+    return 0;
+#endif
+  }
+  std::size_t FrontZone(std::size_t alignment) {
+    return alignment > RED_ZONE ? alignment : RED_ZONE;
+  }
+  // Length of the padding between the block and the guard page.
+  std::size_t PageSlack(std::size_t _size, std::size_t alignment) {
+    std::size_t unit(alignment > MIN_ALIGNMENT ? alignment : MIN_ALIGNMENT);
+    return RoundUp(_size ? _size : 1, unit) - _size;
+  }
+  void *Allocate(std::size_t _size, std::size_t alignment, unsigned char &guard) {
+    if(guard == PAGE_GUARD && (!PageSize() || alignment > PageSize())) 
+      guard = CANARY_GUARD;
+#ifdef LEAK_TESTER_PAGE_GUARD
+    if(guard == PAGE_GUARD) {
+      std::size_t slack(PageSlack(_size, alignment)), 
+        data(RoundUp(_size + slack, PageSize()));
+      void *base(mmap(0, data + PageSize(), PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if(base == MAP_FAILED) return 0;
+      char *fence((char*)base + data);
+      if(mprotect(fence, PageSize(), PROT_NONE)) {
+        munmap(base, data + PageSize()); return 0;
+      }
+      std::memset(fence - slack, CANARY, slack);
+      return fence - slack - _size;
+    }
+#endif
+    std::size_t front(guard == CANARY_GUARD ? FrontZone(alignment) : 0),
+      back(guard == CANARY_GUARD ? RED_ZONE : 0), total(front + _size + back);
+    char *raw;
+    if(!alignment) raw = (char*)std::malloc(total);
+    else {
+#ifdef _WIN32
+      raw = (char*)_aligned_malloc(total, alignment);
+#else
+      void *address(0);
+      raw = posix_memalign(&address, alignment, total) ? 0 : (char*)address;
+#endif
+    }
+    if(!raw || !front) return raw;
+    std::memset(raw, CANARY, front);
+    std::memset(raw + front + _size, CANARY, back);
+    return raw + front;
+  }
+  std::size_t Alignment(const Info &info) {
+    return info.alignment ? (std::size_t)1 << info.alignment : 0;
+  }
+  bool Intact(const char *zone, std::size_t length) {
+    for(std::size_t i = 0; i < length; i++)
+      if((unsigned char)zone[i] != CANARY) return false;
+    return true;
+  }
+  // Reports damaged canaries of a guarded block; returns false if any.
+  bool CheckGuard(const Info &info) {
+    const char *address((const char*)info.address);
+    bool before(true), after(true);
+    if(info.guard == CANARY_GUARD) {
+      std::size_t front(FrontZone(Alignment(info)));
+      before = Intact(address - front, front);
+      after = Intact(address + info._size, RED_ZONE);
+    }
+    else if(info.guard == PAGE_GUARD)
+      after = Intact(address + info._size, PageSlack(info._size, Alignment(info)));
+    if(before && after) return true;
+    Site site(FindSite(info.site));
+    std::fprintf(output, "*** ERROR: Memory %s the %lu bytes on address %p (allocated "
+      "in %s (%s:%d)) has been overwritten!\n", before ? "after" : "before", 
+      (ULong)info._size, info.address, info.site ? site.function : "internally", 
+      site.file, site.line);
+    return false;
+  }
+  void Release(const Info &info) {
+    std::size_t alignment(Alignment(info));
+#ifdef LEAK_TESTER_PAGE_GUARD
+    if(info.guard == PAGE_GUARD) {
+      std::size_t slack(PageSlack(info._size, alignment)),
+        data(RoundUp(info._size + slack, PageSize()));
+      munmap((char*)info.address + info._size + slack - data, data + PageSize());
+      return;
+    }
+#endif
+    char *raw((char*)info.address - (info.guard == CANARY_GUARD ? FrontZone(alignment) : 0));
+#ifdef _WIN32
+    if(alignment) { _aligned_free(raw); return; }
+#endif
+    std::free(raw);
+  }
+  // Verifies the canaries of every live guarded block; returns the number
+  // of damaged ones.
+  long check_canaries() {
+    long damaged(0);
+    for(std::size_t j = 0; j < SHARDS; j++) {
+      Map &shard(alloc_map[j]);
+      std::lock_guard<std::mutex> guard(shard.lock);
+      for(std::size_t i = 0; shard.buckets && i <= shard.mask; i++)
+      for(Info *current = shard.buckets[i]; current; current = current->link)
+        if(current->guard != NO_GUARD && !CheckGuard(*current)) damaged++;
+    }
+    return damaged;
+  }
+  // alignment is 0 for the ordinary operator new, otherwise the value the
+  // std::align_val_t overloads were called with.
+  LEAK_TESTER_NOINLINE void *Alloc(unsigned site, std::size_t _size, bool isArray, 
+    std::size_t alignment = 0) {
+    unsigned char mode(guard_mode);
+    void *address(Allocate(_size, alignment, mode));
+    if(!address) throw std::bad_alloc();
+    if(canary_period && 
+      (canary_ticks.fetch_add(1, std::memory_order_relaxed) + 1) % canary_period == 0)
+      check_canaries();
+    Counters &counters(Local());
+    Add(counters.alloc_count, 1); Add(counters.alloc_total, _size);
+    bool peaked(Occupy(_size));
+    if(notifications) {
+      Site where(FindSite(site));
+      if(!site) std::fprintf(output, ">>> Internally allocated "
+        "%lu bytes, on address %p\n", (ULong)_size, address);
+      else std::fprintf(output, ">>> in %s (%s:%d) we have allocated "
+        "%lu bytes, on address %p\n", where.function, where.file, where.line, 
+        (ULong)_size, address);
+    }
+    Info info = {address, _size, 0, site, CaptureStack(), isArray, Log2(alignment), mode};
+    std::size_t hash(Hash(address));
+    Map &shard(Shard(hash));
+    {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      Insert(shard, hash, info);
+    }
+    // After the insert, so that a peak snapshot counts this allocation.
+    long every(timeline_every.load(std::memory_order_relaxed));
+    if(every) Record(every, peaked);
+    return address;
+  }
+  // _size and alignment come from the sized and aligned operator delete
+  // overloads (0 when not passed) and are checked against the allocation.
+  void Dealloc(void *ptr, bool isArray, std::size_t _size = 0, 
+    std::size_t alignment = 0) {
+    if(!ptr) return;
+    std::size_t hash(Hash(ptr));
+    Map &shard(Shard(hash));
+    std::unique_lock<std::mutex> guard(shard.lock);
+    Info **link(Find(shard, hash, ptr));
+    if(link) {
+      Info current(**link);
+      Erase(shard, link);
+      guard.unlock();
+      Counters &counters(Local());
+      Add(counters.dealloc_count, 1); Add(counters.dealloc_total, current._size);
+      Occupy(-(long)current._size);
+      if(notifications) {
+        std::fprintf(output, ">>> Releasing %lu bytes on address %p\n", 
+          (ULong)current._size, ptr);
       }
-      if(previous) previous->link = current->link;                   
-      else alloc_map = current->link;
-      std::free(current); std::free(ptr);     
+      if(isArray != current.isArray)
+        std::fprintf(output, "*** ERROR: Releasing on address %p %s "
+          "should be done with delete[]!\n", 
+          ptr, isArray ? "no" : "yes");
+      if(_size && _size != current._size)
+        std::fprintf(output, "*** ERROR: Releasing on address %p claims %lu "
+          "bytes, but %lu were allocated!\n", ptr, (ULong)_size, (ULong)current._size);
+      if(Log2(alignment) != current.alignment)
+        std::fprintf(output, "*** ERROR: Releasing on address %p should be done "
+          "with %s operator delete!\n", ptr, current.alignment ? "an aligned" : "the plain");
+      if(current.guard != NO_GUARD) CheckGuard(current);
+      Release(current);     
     }
-    else if(ptr) {
+    else {
+      guard.unlock();
       const std::size_t pomak(sizeof(std::size_t)); 
       void *ptr1((char*)ptr + (isArray ? pomak : -pomak));
-      for(current = alloc_map; current && current->address != ptr1; 
-        current = current->link);
-      if(current)
+      if(Tracked(ptr1))
         std::fprintf(output, "*** ERROR: Releasing on address %p %s should "
           "be done with delete[]!\n", ptr1, isArray ? "no" : "yes");
       else              
@@ -101,56 +748,72 @@ namespace __Tester__ {
     void (*old_terminator)();
     Reporter() : old_terminator(std::set_terminate(Terminator)) {}
     ~Reporter() {
+      Totals totals(Sum());
+      std::size_t leaks(0);
+      for(std::size_t i = 0; i < SHARDS; i++) leaks += alloc_map[i].count;
       std::fprintf(output, "\n\n+---------------+\n| FINAL REPORT: |\n"
-        "+---------------+\n\nTotal number of allocations: %d\nTotal number of "
-        "deallocations: %d\nTotal number of allocations in bytes: %ld\n"
+        "+---------------+\n\nTotal number of allocations: %ld\nTotal number of "
+        "deallocations: %ld\nTotal number of allocations in bytes: %ld\n"
         "Total number of deallocations in bytes: %ld\nMaximum "
         "memory occupation during runtime in bytes: %ld\nMemory occupation "
-        "upon completion: %ld\n", alloc_count,
-        dealloc_count, alloc_total, dealloc_total, 
-        alloc_max, alloc_current); 
-      if(alloc_map) {
+        "upon completion: %ld\n", totals.alloc_count,
+        totals.dealloc_count, totals.alloc_total, totals.dealloc_total, 
+        alloc_max.load(), alloc_current.load()); 
+      if(leaks) {
         std::fprintf(output, "\n\nLEAK! YOU HAVE MEMORY LEAKAGE ON FOLLOWING PLACES: \n");
-        for(Info *current = alloc_map; current; current = current->link)
-          if(current->line == -2)
-            std::fprintf(output, " - address %p, %lu bytes, allocated internally\n",
-              current->address, (ULong)current->_size);
+        for(std::size_t j = 0; j < SHARDS; j++) alloc_map[j].lock.lock();
+        Group *groups(0);
+        std::size_t count(GroupAllocations(groups, leaks));
+        for(std::size_t j = 0; j < SHARDS; j++) alloc_map[j].lock.unlock();
+        for(std::size_t i = 0; i < count; i++) {
+          Site site(FindSite(groups[i].site));
+          if(!groups[i].site)
+            std::fprintf(output, " - %ld allocations, %lu bytes (e.g. address %p), "
+              "allocated internally\n", groups[i].count, (ULong)groups[i].bytes, 
+              groups[i].example);
           else
-            std::fprintf(output, " - address %p, %lu bytes, allocated in %ld. "
-              "line\n", current->address, (ULong)current->_size, 
-              current->line);
+            std::fprintf(output, " - %ld allocations, %lu bytes (e.g. address %p), "
+              "allocated in %s (%s:%d)\n", groups[i].count, (ULong)groups[i].bytes, 
+              groups[i].example, site.function, site.file, site.line);
+          PrintStack(groups[i].stack);
+        }
+        std::free(groups);
         std::fprintf(output, "\n");
       }
       else
         std::fprintf(output, "\n\nGREAT JOB! YOU DO NOT HAVE MEMORY LEAKAGE\n\n");
       if(output != stdout) fclose(output);  
+      if(timeline_every) WriteTimeline();
       std::system("PAUSE");
     }  
   } reporter;
   void Terminator() {
+    // Read before the destructor ends reporter's lifetime.
+    void (*next)() = reporter.old_terminator;
     reporter.Reporter::~Reporter();
-    reporter.old_terminator();
+    if(next) next();
+    std::abort();
   }   
 }
 
-void *operator new(std::size_t _size, long line) // throw(std::bad_alloc)
+void *operator new(std::size_t _size) //   throw(std::bad_alloc)
 {
-  return __Tester__::Alloc(line, _size, false);
-}
+  return __Tester__::Alloc(0, _size, false); 
+}                                                    // Hvata interne alokacije
 
-void* operator new[](std::size_t _size, long line) // throw(std::bad_alloc)
+void* operator new[](std::size_t _size) // throw(std::bad_alloc)
 {
-  return __Tester__::Alloc(line, _size, true);
+  return __Tester__::Alloc(0, _size, true);
 }
 
-void *operator new(std::size_t _size) //   throw(std::bad_alloc)
+void *operator new(std::size_t _size, const char *file, int line, const char *function)
 {
-  return __Tester__::Alloc(-2, _size, false); 
-}                                                    // Hvata interne alokacije
+  return __Tester__::Alloc(__Tester__::SiteOf(file, line, function), _size, false);
+}
 
-void* operator new[](std::size_t _size) // throw(std::bad_alloc)
+void* operator new[](std::size_t _size, const char *file, int line, const char *function)
 {
-  return __Tester__::Alloc(-2, _size, true);
+  return __Tester__::Alloc(__Tester__::SiteOf(file, line, function), _size, true);
 }
 
 void operator delete(void *ptr) throw() {
@@ -161,14 +824,85 @@ void operator delete[](void* ptr) throw() {
   __Tester__::Dealloc(ptr, true);   
 }
 
-void operator delete(void *ptr, long) throw() {    // placement delete!!!
+void operator delete(void *ptr, const char *, int, const char *) throw() {    // placement delete!!!
   __Tester__::Dealloc(ptr, false);
 }
  
-void operator delete[](void* ptr, long) throw() {
+void operator delete[](void* ptr, const char *, int, const char *) throw() {
   __Tester__::Dealloc(ptr, true);   
 }
 
-#define new new(__LINE__)
+// Sized deallocation (C++14). The size only has to be checked: the entry
+// still has to be unlinked, so the map is probed once as for plain delete.
+void operator delete(void *ptr, std::size_t _size) throw() {
+  __Tester__::Dealloc(ptr, false, _size);
+}
+
+void operator delete[](void *ptr, std::size_t _size) throw() {
+  __Tester__::Dealloc(ptr, true, _size);
+}
+
+#ifdef __cpp_aligned_new
+// Over-aligned types (C++17) would otherwise bypass the tester entirely.
+void *operator new(std::size_t _size, std::align_val_t alignment)
+{
+  return __Tester__::Alloc(0, _size, false, (std::size_t)alignment);
+}
+
+void *operator new[](std::size_t _size, std::align_val_t alignment)
+{
+  return __Tester__::Alloc(0, _size, true, (std::size_t)alignment);
+}
+
+void *operator new(std::size_t _size, std::align_val_t alignment, const char *file, 
+  int line, const char *function)
+{
+  return __Tester__::Alloc(__Tester__::SiteOf(file, line, function), _size, false, 
+    (std::size_t)alignment);
+}
+
+void *operator new[](std::size_t _size, std::align_val_t alignment, const char *file, 
+  int line, const char *function)
+{
+  return __Tester__::Alloc(__Tester__::SiteOf(file, line, function), _size, true, 
+    (std::size_t)alignment);
+}
+
+void operator delete(void *ptr, std::align_val_t alignment) throw() {
+  __Tester__::Dealloc(ptr, false, 0, (std::size_t)alignment);
+}
+
+void operator delete[](void *ptr, std::align_val_t alignment) throw() {
+  __Tester__::Dealloc(ptr, true, 0, (std::size_t)alignment);
+}
+
+void operator delete(void *ptr, std::size_t _size, std::align_val_t alignment) throw() {
+  __Tester__::Dealloc(ptr, false, _size, (std::size_t)alignment);
+}
+
+void operator delete[](void *ptr, std::size_t _size, std::align_val_t alignment) throw() {
+  __Tester__::Dealloc(ptr, true, _size, (std::size_t)alignment);
+}
+
+void operator delete(void *ptr, std::align_val_t alignment, const char *, int, 
+  const char *) throw() {
+  __Tester__::Dealloc(ptr, false, 0, (std::size_t)alignment);
+}
+
+void operator delete[](void *ptr, std::align_val_t alignment, const char *, int, 
+  const char *) throw() {
+  __Tester__::Dealloc(ptr, true, 0, (std::size_t)alignment);
+}
+#endif
+
+// LEAK_NEW T(...) allocates like new T(...) and records the call site
+// for the report. Defining LEAK_TESTER_NEW_MACRO before this header makes
+// every new expression after it do the same; that spelling rules out
+// placement new, and headers that use ::new or operator new (standard
+// headers do) must then come first, so it is off by default.
+#define LEAK_NEW new(__FILE__, __LINE__, LEAK_TESTER_FUNCTION)
+#ifdef LEAK_TESTER_NEW_MACRO
+#define new LEAK_NEW
+#endif
  
 #endif
@@ -0,0 +1,47 @@
+// Cost of LeakTester's overrun detection modes: allocates, touches and
+// releases batches of mixed-size blocks under each GUARD_MODE and prints
+// the average time per allocation/release pair.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../LeakTester.h"
+
+namespace {
+const int BATCH = 4096;
+const int ROUNDS = 64;
+
+double run(int rounds) {
+  static char *blocks[BATCH];
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < BATCH; i++) {
+      std::size_t size = 8 + (i * 37) % 249;
+      blocks[i] = new char[size];
+      std::memset(blocks[i], i, size);
+    }
+    for (int i = 0; i < BATCH; i++)
+      delete[] blocks[i];
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (double(rounds) * BATCH);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? std::atoi(argv[1]) : ROUNDS;
+  run(1); // warm up the map and the allocator
+  std::printf("mode,ns_per_alloc_free\n");
+  GUARD_MODE(NO_GUARD, 0);
+  std::printf("none,%.1f\n", run(rounds));
+  GUARD_MODE(CANARY_GUARD, 0);
+  std::printf("canary,%.1f\n", run(rounds));
+  // A batch check every 1024 allocations walks all live blocks.
+  GUARD_MODE(CANARY_GUARD, 1024);
+  std::printf("canary_batch_1024,%.1f\n", run(rounds));
+  GUARD_MODE(PAGE_GUARD, 0);
+  std::printf("page,%.1f\n", run(rounds > 8 ? rounds / 8 : 1));
+  GUARD_MODE(NO_GUARD, 0);
+  return 0;
+}
@@ -0,0 +1,283 @@
+// Microbenchmarks for Pointer's basic operations against std::shared_ptr
+// and raw new/delete, on Google Benchmark:
+//   construct, copy, both operator= overloads, destroy, collect() at
+//   several heap sizes and garbage ratios, and Iter traversal.
+// Every Pointer destructor runs collect(), and raw pointers are looked up
+// in refContainer, so most Pointer costs grow with the number of live
+// blocks; the first argument of those benchmarks is that number.
+// Build with -DGC_THREAD_SAFE to also get the multi-threaded variants.
+// Use --benchmark_format=csv|json or --benchmark_out=<file> for reports.
+//   g++ -std=c++17 -O2 bench/pointer_ops.cpp -lbenchmark -lpthread
+#define GC_QUIET
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "../gc_pointer.h"
+
+namespace {
+
+// Keeps n blocks alive so that refContainer<int> has n entries.
+struct LiveHeap {
+  std::vector<Pointer<int>> live;
+  explicit LiveHeap(int n) {
+    live.reserve(n);
+    for (int i = 0; i < n; i++)
+      live.emplace_back(new int(i));
+  }
+};
+
+void heapSizes(benchmark::internal::Benchmark *b) {
+  for (int n : {0, 64, 1024, 4096})
+    b->Arg(n);
+}
+
+// Construction includes destruction (and so one collect()).
+void BM_Construct_Pointer(benchmark::State &state) {
+  LiveHeap heap(state.range(0));
+  for (auto _ : state) {
+    Pointer<int> p(new int(1));
+    benchmark::DoNotOptimize(p.operator int *());
+  }
+}
+BENCHMARK(BM_Construct_Pointer)->Apply(heapSizes);
+
+void BM_Construct_SharedPtr(benchmark::State &state) {
+  for (auto _ : state) {
+    std::shared_ptr<int> p(new int(1));
+    benchmark::DoNotOptimize(p.get());
+  }
+}
+BENCHMARK(BM_Construct_SharedPtr);
+
+void BM_Construct_MakeShared(benchmark::State &state) {
+  for (auto _ : state) {
+    std::shared_ptr<int> p = std::make_shared<int>(1);
+    benchmark::DoNotOptimize(p.get());
+  }
+}
+BENCHMARK(BM_Construct_MakeShared);
+
+void BM_Construct_Raw(benchmark::State &state) {
+  for (auto _ : state) {
+    int *p = new int(1);
+    benchmark::DoNotOptimize(p);
+    delete p;
+  }
+}
+BENCHMARK(BM_Construct_Raw);
+
+// A copy that goes out of scope again, leaving no garbage.
+void BM_Copy_Pointer(benchmark::State &state) {
+  LiveHeap heap(state.range(0));
+  Pointer<int> p(new int(1));
+  for (auto _ : state) {
+    Pointer<int> q(p);
+    benchmark::DoNotOptimize(q.operator int *());
+  }
+}
+BENCHMARK(BM_Copy_Pointer)->Apply(heapSizes);
+
+void BM_Copy_SharedPtr(benchmark::State &state) {
+  std::shared_ptr<int> p(new int(1));
+  for (auto _ : state) {
+    std::shared_ptr<int> q(p);
+    benchmark::DoNotOptimize(q.get());
+  }
+}
+BENCHMARK(BM_Copy_SharedPtr);
+
+// Pointer = Pointer between two live blocks.
+void BM_AssignPointer_Pointer(benchmark::State &state) {
+  LiveHeap heap(state.range(0));
+  Pointer<int> a(new int(1)), b(new int(2)), p;
+  for (auto _ : state) {
+    p = a;
+    p = b;
+    benchmark::DoNotOptimize(p.operator int *());
+  }
+  state.SetItemsProcessed(2 * state.iterations());
+}
+BENCHMARK(BM_AssignPointer_Pointer)->Apply(heapSizes);
+
+void BM_AssignPointer_SharedPtr(benchmark::State &state) {
+  std::shared_ptr<int> a(new int(1)), b(new int(2)), p;
+  for (auto _ : state) {
+    p = a;
+    p = b;
+    benchmark::DoNotOptimize(p.get());
+  }
+  state.SetItemsProcessed(2 * state.iterations());
+}
+BENCHMARK(BM_AssignPointer_SharedPtr);
+
+// Pointer = T*. Assignment does not collect, so the replaced blocks are
+// collected outside the timed region every 256 iterations.
+void BM_AssignRaw_Pointer(benchmark::State &state) {
+  LiveHeap heap(state.range(0));
+  Pointer<int> p;
+  int n = 0;
+  for (auto _ : state) {
+    p = new int(1);
+    if (++n == 256) {
+      state.PauseTiming();
+      Pointer<int>::collect();
+      n = 0;
+      state.ResumeTiming();
+    }
+  }
+}
+BENCHMARK(BM_AssignRaw_Pointer)->Apply(heapSizes);
+
+void BM_AssignRaw_SharedPtr(benchmark::State &state) {
+  std::shared_ptr<int> p;
+  for (auto _ : state) {
+    p.reset(new int(1));
+    benchmark::DoNotOptimize(p.get());
+  }
+}
+BENCHMARK(BM_AssignRaw_SharedPtr);
+
+// Destroying the last Pointer to a block, which frees it.
+const int BATCH = 256;
+
+void BM_Destroy_Pointer(benchmark::State &state) {
+  LiveHeap heap(state.range(0));
+  for (auto _ : state) {
+    std::vector<Pointer<int>> *batch = new std::vector<Pointer<int>>();
+    batch->reserve(BATCH);
+    for (int i = 0; i < BATCH; i++)
+      batch->emplace_back(new int(i));
+    auto start = std::chrono::steady_clock::now();
+    delete batch;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    state.SetIterationTime(elapsed.count());
+  }
+  state.SetItemsProcessed(BATCH * state.iterations());
+}
+BENCHMARK(BM_Destroy_Pointer)->Apply(heapSizes)->UseManualTime();
+
+void BM_Destroy_SharedPtr(benchmark::State &state) {
+  for (auto _ : state) {
+    std::vector<std::shared_ptr<int>> *batch =
+        new std::vector<std::shared_ptr<int>>();
+    batch->reserve(BATCH);
+    for (int i = 0; i < BATCH; i++)
+      batch->push_back(std::shared_ptr<int>(new int(i)));
+    auto start = std::chrono::steady_clock::now();
+    delete batch;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    state.SetIterationTime(elapsed.count());
+  }
+  state.SetItemsProcessed(BATCH * state.iterations());
+}
+BENCHMARK(BM_Destroy_SharedPtr)->UseManualTime();
+
+// One collect() over range(0) blocks of which range(1) percent are
+// garbage. Only collect() is timed; the garbage is replaced with new
+// blocks between iterations.
+void BM_Collect(benchmark::State &state) {
+  int blocks = state.range(0);
+  int garbage = blocks * state.range(1) / 100;
+  LiveHeap heap(blocks);
+  for (auto _ : state) {
+    // Spread the garbage over the list.
+    for (int i = 0; i < garbage; i++)
+      heap.live[(long long)i * blocks / garbage] = nullptr;
+    auto start = std::chrono::steady_clock::now();
+    Pointer<int>::collect();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    state.SetIterationTime(elapsed.count());
+    for (int i = 0; i < garbage; i++)
+      heap.live[(long long)i * blocks / garbage] = new int(i);
+  }
+  state.SetItemsProcessed(blocks * state.iterations());
+}
+BENCHMARK(BM_Collect)
+    ->ArgsProduct({{256, 1024, 4096}, {0, 10, 50, 100}})
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// Summing an array through Iter, checked and unchecked, and raw.
+template <bool Checked> void BM_Traverse_Iter(benchmark::State &state) {
+  unsigned n = state.range(0);
+  Pointer<int> array = make_gc_array<int>(n);
+  int *data = array;
+  for (auto _ : state) {
+    long long total = 0;
+    Iter<int, Checked> it(data, data, data + n), end(data + n, data, data + n);
+    for (; it != end; ++it)
+      total += *it;
+    benchmark::DoNotOptimize(total);
+  }
+  state.SetItemsProcessed(n * state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Traverse_Iter, true)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_Traverse_Iter, false)->Range(1 << 10, 1 << 20);
+
+void BM_Traverse_Raw(benchmark::State &state) {
+  unsigned n = state.range(0);
+  std::unique_ptr<int[]> array(new int[n]());
+  int *data = array.get();
+  for (auto _ : state) {
+    long long total = 0;
+    for (int *p = data; p != data + n; ++p)
+      total += *p;
+    benchmark::DoNotOptimize(total);
+  }
+  state.SetItemsProcessed(n * state.iterations());
+}
+BENCHMARK(BM_Traverse_Raw)->Range(1 << 10, 1 << 20);
+
+#ifdef GC_THREAD_SAFE
+// Every thread copies the same Pointer, contending on the collector lock
+// (and on the shared count for shared_ptr).
+Pointer<int> *shared;
+
+void BM_CopyShared_Pointer(benchmark::State &state) {
+  if (state.thread_index() == 0)
+    shared = new Pointer<int>(new int(1));
+  for (auto _ : state) {
+    Pointer<int> q(*shared);
+    benchmark::DoNotOptimize(q.operator int *());
+  }
+  if (state.thread_index() == 0)
+    delete shared;
+}
+BENCHMARK(BM_CopyShared_Pointer)->ThreadRange(1, 8)->UseRealTime();
+
+std::shared_ptr<int> sharedPtr(new int(1));
+
+void BM_CopyShared_SharedPtr(benchmark::State &state) {
+  for (auto _ : state) {
+    std::shared_ptr<int> q(sharedPtr);
+    benchmark::DoNotOptimize(q.get());
+  }
+}
+BENCHMARK(BM_CopyShared_SharedPtr)->ThreadRange(1, 8)->UseRealTime();
+
+// Every thread allocates and drops its own blocks, still through the
+// one refContainer<int>.
+void BM_ConstructThreads_Pointer(benchmark::State &state) {
+  for (auto _ : state) {
+    Pointer<int> p(new int(1));
+    benchmark::DoNotOptimize(p.operator int *());
+  }
+}
+BENCHMARK(BM_ConstructThreads_Pointer)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_ConstructThreads_SharedPtr(benchmark::State &state) {
+  for (auto _ : state) {
+    std::shared_ptr<int> p(new int(1));
+    benchmark::DoNotOptimize(p.get());
+  }
+}
+BENCHMARK(BM_ConstructThreads_SharedPtr)->ThreadRange(1, 8)->UseRealTime();
+#endif
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,474 @@
+// Macro workloads that use Pointer the way real programs do:
+//   binary_trees  GCBench: many short-lived trees next to a long-lived one
+//   lru           LRU cache with churn over a doubly linked recency list
+//   graph         random graph with cycles, walked and rewired
+//   queue         producers and consumers passing messages across threads
+//   server        steady-state request loop over long-lived sessions
+// Pointer collects inline, in the destructor that drops the last
+// reference, so pauses show up as slow operations: each workload reports
+// its throughput, the latency percentiles of its operations (end-to-end
+// message latency for queue) and its peak RSS, as CSV. graph also
+// reports the blocks that reference counting could not reclaim because
+// they sit on cycles.
+//   workloads [all|<workload>] [scale]
+// "all" runs every workload in its own process so that peak RSS is per
+// workload. scale multiplies the amount of work (default 1). Built with
+// -DGC_TRACE, each workload also writes <workload>.trace.json, with its
+// operations as "op" spans next to the collector's events (the last
+// GC_TRACE_EVENTS of them).
+// Built with -DGC_PERF, each workload also prints the collector's
+// hardware counters per phase to stderr, as CSV.
+//   g++ -std=c++17 -O2 bench/workloads.cpp -lpthread
+#define GC_QUIET
+#define GC_THREAD_SAFE
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../gc_pointer.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result {
+  long long ops;
+  double seconds;
+  std::vector<double> latencies; // microseconds
+  long long unreclaimed;
+};
+
+double percentile(std::vector<double> &sorted, double q) {
+  if (sorted.empty())
+    return 0;
+  std::size_t i = (std::size_t)(q * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+void report(const char *name, Result &r) {
+#ifdef GC_TRACE
+  std::string trace = std::string(name) + ".trace.json";
+  if (!GCTrace::dump(trace.c_str()))
+    std::fprintf(stderr, "cannot write %s\n", trace.c_str());
+#endif
+#ifdef GC_PERF
+  std::fprintf(stderr, "# %s\n", name);
+  GCPerf::report(stderr);
+#endif
+  std::sort(r.latencies.begin(), r.latencies.end());
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::printf("%s,%lld,%.3f,%.0f,%.2f,%.2f,%.2f,%.2f,%ld,%lld\n", name,
+              r.ops, r.seconds, r.ops / r.seconds,
+              percentile(r.latencies, 0.50), percentile(r.latencies, 0.90),
+              percentile(r.latencies, 0.99),
+              r.latencies.empty() ? 0.0 : r.latencies.back(),
+              usage.ru_maxrss, r.unreclaimed);
+  std::fflush(stdout);
+}
+
+double since(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+// Start and finish timing one operation.
+Clock::time_point opBegin() {
+#ifdef GC_TRACE
+  GCTrace::begin("op");
+#endif
+  return Clock::now();
+}
+
+void opEnd(Result &r, Clock::time_point op) {
+  r.latencies.push_back(since(op));
+#ifdef GC_TRACE
+  GCTrace::end("op");
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// binary_trees: build, check and drop trees of growing depth while a
+// long-lived tree and array stay reachable. One operation is one
+// short-lived tree.
+struct TreeNode {
+  Pointer<TreeNode> left, right;
+  TreeNode() {}
+  TreeNode(const Pointer<TreeNode> &l, const Pointer<TreeNode> &r)
+      : left(l), right(r) {}
+};
+
+Pointer<TreeNode> bottomUpTree(int depth) {
+  if (depth <= 0)
+    return make_gc<TreeNode>();
+  return make_gc<TreeNode>(bottomUpTree(depth - 1), bottomUpTree(depth - 1));
+}
+
+int checkTree(Pointer<TreeNode> &node) {
+  if (!node->left)
+    return 1;
+  return 1 + checkTree(node->left) + checkTree(node->right);
+}
+
+Result binaryTrees(int scale) {
+  const int minDepth = 4, maxDepth = 10;
+  Result r = Result();
+  Clock::time_point start = Clock::now();
+  Pointer<TreeNode> longLived = bottomUpTree(maxDepth);
+  Pointer<double> array = make_gc_array<double>(500000);
+  long long nodes = 0;
+  for (int depth = minDepth; depth <= maxDepth; depth += 2) {
+    int iterations = scale * (1 << (maxDepth - depth + minDepth)) / 4;
+    for (int i = 0; i < iterations; i++) {
+      Clock::time_point op = opBegin();
+      {
+        Pointer<TreeNode> tree = bottomUpTree(depth);
+        nodes += checkTree(tree);
+      }
+      opEnd(r, op);
+      r.ops++;
+    }
+  }
+  nodes += checkTree(longLived) + (array[1000] == 0);
+  r.seconds = since(start) / 1e6;
+  if (nodes == 0)
+    std::abort();
+  return r;
+}
+
+//////////////////////////////////////////////////////////////////////
+// lru: a hash map onto a recency list whose next links are Pointers and
+// prev links WeakPointers, so an evicted entry is freed at once. Keys
+// are drawn from twice the capacity, so about half the lookups miss and
+// evict.
+struct LruEntry {
+  int key;
+  int value;
+  Pointer<LruEntry> next;
+  WeakPointer<LruEntry> prev;
+  LruEntry(int k, int v) : key(k), value(v) {}
+};
+
+class LruCache {
+  std::unordered_map<int, Pointer<LruEntry>> index;
+  Pointer<LruEntry> head;
+  WeakPointer<LruEntry> tail;
+  std::size_t capacity;
+
+  void unlink(Pointer<LruEntry> &e) {
+    Pointer<LruEntry> prev = e->prev.lock();
+    Pointer<LruEntry> next = e->next;
+    if (prev)
+      prev->next = next;
+    else
+      head = next;
+    if (next)
+      next->prev = prev;
+    else
+      tail = prev;
+    e->next = nullptr;
+    e->prev = WeakPointer<LruEntry>();
+  }
+
+  void pushFront(Pointer<LruEntry> &e) {
+    e->next = head;
+    if (head)
+      head->prev = e;
+    else
+      tail = e;
+    head = e;
+  }
+
+public:
+  explicit LruCache(std::size_t c) : capacity(c) {}
+
+  bool get(int key, int &value) {
+    auto it = index.find(key);
+    if (it == index.end())
+      return false;
+    Pointer<LruEntry> e = it->second;
+    unlink(e);
+    pushFront(e);
+    value = e->value;
+    return true;
+  }
+
+  void put(int key, int value) {
+    auto it = index.find(key);
+    if (it != index.end()) {
+      Pointer<LruEntry> e = it->second;
+      e->value = value;
+      unlink(e);
+      pushFront(e);
+      return;
+    }
+    if (index.size() == capacity) {
+      Pointer<LruEntry> victim = tail.lock();
+      unlink(victim);
+      index.erase(victim->key);
+    }
+    Pointer<LruEntry> e = make_gc<LruEntry>(key, value);
+    pushFront(e);
+    index.emplace(key, e);
+  }
+};
+
+Result lru(int scale) {
+  const int capacity = 1000;
+  const long long ops = 100000LL * scale;
+  Result r = Result();
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> keys(0, 2 * capacity - 1);
+  Clock::time_point start = Clock::now();
+  {
+    LruCache cache(capacity);
+    for (long long i = 0; i < ops; i++) {
+      int key = keys(rng), value;
+      Clock::time_point op = opBegin();
+      if (!cache.get(key, value))
+        cache.put(key, (int)i);
+      opEnd(r, op);
+    }
+  }
+  r.seconds = since(start) / 1e6;
+  r.ops = ops;
+  return r;
+}
+
+//////////////////////////////////////////////////////////////////////
+// graph: nodes with a few strong edges each, so most of the graph is on
+// cycles. Operations walk from a root and rewire an edge to a new node;
+// the node losing the edge is freed only if no cycle holds it. At the
+// end the roots are dropped and what is left in refContainer is the
+// cyclic garbage, which is then freed by clearing the edges by hand.
+struct GraphNode {
+  int id;
+  std::vector<Pointer<GraphNode>> edges;
+  explicit GraphNode(int i) : id(i) {}
+};
+
+Result graph(int scale) {
+  const int nodes = 2000, degree = 3, rootCount = 20, walk = 8;
+  const long long ops = 20000LL * scale;
+  Result r = Result();
+  std::mt19937 rng(7);
+  std::vector<WeakPointer<GraphNode>> all;
+  Clock::time_point start = Clock::now();
+  {
+    std::vector<Pointer<GraphNode>> roots;
+    {
+      std::vector<Pointer<GraphNode>> built;
+      built.reserve(nodes);
+      for (int i = 0; i < nodes; i++) {
+        built.push_back(make_gc<GraphNode>(i));
+        built.back()->edges.reserve(degree);
+        all.push_back(built.back());
+      }
+      for (int i = 0; i < nodes; i++)
+        for (int e = 0; e < degree; e++)
+          built[i]->edges.push_back(built[rng() % nodes]);
+      roots.assign(built.begin(), built.begin() + rootCount);
+    }
+    int nextId = nodes;
+    for (long long i = 0; i < ops; i++) {
+      Clock::time_point op = opBegin();
+      Pointer<GraphNode> node = roots[rng() % rootCount];
+      for (int step = 0; step < walk; step++)
+        node = node->edges[rng() % degree];
+      Pointer<GraphNode> fresh = make_gc<GraphNode>(nextId++);
+      all.push_back(fresh);
+      fresh->edges.reserve(degree);
+      for (int e = 0; e < degree; e++)
+        fresh->edges.push_back(node->edges[e]);
+      node->edges[rng() % degree] = fresh;
+      opEnd(r, op);
+    }
+  }
+  Pointer<GraphNode>::collect();
+  r.unreclaimed = Pointer<GraphNode>::refContainerSize();
+  for (std::size_t i = 0; i < all.size(); i++) {
+    Pointer<GraphNode> node = all[i].lock();
+    if (node)
+      node->edges.clear();
+  }
+  all.clear();
+  Pointer<GraphNode>::collect();
+  r.seconds = since(start) / 1e6;
+  r.ops = ops;
+  return r;
+}
+
+//////////////////////////////////////////////////////////////////////
+// queue: producers allocate messages and hand them to consumers through
+// a bounded queue; the consumer's copy is the last one, so messages are
+// freed on the consumer threads.
+struct Message {
+  Clock::time_point sent;
+  int payload[14];
+};
+
+Result queue(int scale) {
+  const int producers = 2, consumers = 2, capacity = 1024;
+  const long long perProducer = 50000LL * scale;
+  Result r = Result();
+  std::deque<Pointer<Message>> q;
+  std::mutex m;
+  std::condition_variable notEmpty, notFull;
+  int producing = producers;
+  std::vector<std::vector<double>> latencies(consumers);
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++)
+    threads.emplace_back([&, p] {
+      for (long long i = 0; i < perProducer; i++) {
+        Pointer<Message> msg = make_gc<Message>();
+        msg->payload[0] = p;
+        msg->sent = Clock::now();
+        std::unique_lock<std::mutex> lock(m);
+        notFull.wait(lock, [&] { return q.size() < (std::size_t)capacity; });
+        q.push_back(msg);
+        notEmpty.notify_one();
+      }
+      std::lock_guard<std::mutex> lock(m);
+      if (--producing == 0)
+        notEmpty.notify_all();
+    });
+  for (int c = 0; c < consumers; c++)
+    threads.emplace_back([&, c] {
+      for (;;) {
+        Pointer<Message> msg;
+        {
+          std::unique_lock<std::mutex> lock(m);
+          notEmpty.wait(lock, [&] { return !q.empty() || producing == 0; });
+          if (q.empty())
+            return;
+          msg = q.front();
+          q.pop_front();
+          notFull.notify_one();
+        }
+        latencies[c].push_back(since(msg->sent));
+      }
+    });
+  for (std::size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+  r.seconds = since(start) / 1e6;
+  r.ops = producers * perProducer;
+  for (int c = 0; c < consumers; c++)
+    r.latencies.insert(r.latencies.end(), latencies[c].begin(),
+                       latencies[c].end());
+  return r;
+}
+
+//////////////////////////////////////////////////////////////////////
+// server: each request looks up (or opens) a session, allocates a
+// request with a body, builds a response buffer and keeps it in the
+// session's short history. Sessions expire now and then, so the live
+// set stays about the same size for the whole run.
+const int HISTORY = 8;
+
+struct Session {
+  int id;
+  long long requests;
+  Pointer<char> history[HISTORY];
+  explicit Session(int i) : id(i), requests(0) {}
+};
+
+struct Request {
+  int session;
+  Pointer<char> body;
+  Request(int s, unsigned size) : session(s), body(make_gc_array<char>(size)) {}
+};
+
+Result server(int scale) {
+  const int sessions = 256;
+  const long long ops = 50000LL * scale;
+  Result r = Result();
+  std::mt19937 rng(3);
+  std::unordered_map<int, Pointer<Session>> open;
+  Clock::time_point start = Clock::now();
+  long long checksum = 0;
+  for (long long i = 0; i < ops; i++) {
+    Clock::time_point op = opBegin();
+    int id = rng() % sessions;
+    auto it = open.find(id);
+    if (it == open.end())
+      it = open.emplace(id, make_gc<Session>(id)).first;
+    Pointer<Session> session = it->second;
+    Pointer<Request> request = make_gc<Request>(id, 64 + rng() % 960);
+    std::memset(request->body, (int)i, request->body.span().size());
+    Pointer<char> response = make_gc_array<char>(128 + rng() % 1920);
+    response[0] = request->body[0];
+    checksum += response[0];
+    session->history[session->requests++ % HISTORY] = response;
+    if (rng() % 100 == 0)
+      open.erase(rng() % sessions);
+    opEnd(r, op);
+  }
+  open.clear();
+  r.seconds = since(start) / 1e6;
+  r.ops = ops;
+  if (checksum == -1)
+    std::abort();
+  return r;
+}
+
+struct Workload {
+  const char *name;
+  Result (*run)(int scale);
+};
+
+const Workload workloads[] = {
+    {"binary_trees", binaryTrees},
+    {"lru", lru},
+    {"graph", graph},
+    {"queue", queue},
+    {"server", server},
+};
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *which = argc > 1 ? argv[1] : "all";
+  int scale = argc > 2 ? std::atoi(argv[2]) : 1;
+  if (scale < 1)
+    scale = 1;
+  bool all = std::strcmp(which, "all") == 0;
+  bool found = false;
+  std::printf("workload,ops,seconds,ops_per_s,p50_us,p90_us,p99_us,max_us,"
+              "peak_rss_kib,unreclaimed\n");
+  std::fflush(stdout);
+  for (const Workload &w : workloads) {
+    if (!all && std::strcmp(which, w.name) != 0)
+      continue;
+    found = true;
+    if (!all) {
+      Result r = w.run(scale);
+      report(w.name, r);
+      continue;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+      Result r = w.run(scale);
+      report(w.name, r);
+      std::_Exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+  }
+  if (!found) {
+    std::fprintf(stderr, "unknown workload %s\n", which);
+    return 1;
+  }
+  return 0;
+}
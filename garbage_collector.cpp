@@ -1,5 +1,7 @@
-#include "LeakTester.h"
 #include "gc_pointer.h"
+// Report the line of every new expression below.
+#define LEAK_TESTER_NEW_MACRO
+#include "LeakTester.h"
 
 int main() {
   Pointer<int> p = new int(19);
@@ -0,0 +1,325 @@
+// Compaction for relocatable types. A type opts in with
+//   template <> struct GCRelocatable<Particle> : std::true_type {};
+// after which Pointer<Particle>::compact() moves every live block it
+// can into one new region of whole pages, in refContainer order, and
+// frees the memory they came from. Blocks freed later give their space
+// back to the region, and the last one out unmaps it, so memory is
+// returned to the OS a region at a time rather than left in the holes
+// of the malloc heap.
+//
+// Pointers to a relocatable type find the object through their
+// PtrDetails instead of keeping its address, so they follow it. Raw
+// pointers, references, Iters and Spans taken before compact() do not,
+// and must not be kept across it. A relocatable type must be move
+// constructible without throwing (this is not checked, as Pointer
+// members have a copy constructor that is not noexcept), must not be
+// polymorphic, and must not depend on its own address; Pointers to it
+// cannot be converted or aliased, since those keep an address. Blocks
+// with a custom deleter, and arrays of types with a destructor (whose
+// new[] cookie hides where the memory starts), stay where they are.
+//
+// With GC_THREAD_SAFE, compact() must not move an object another thread
+// is using. Threads dereference Pointers to relocatable types only while
+// holding a GCRelocationGuard (debug builds assert this), and compact()
+// waits until no other thread holds one. Take the guard before anything
+// that takes the collector lock, never inside a collection.
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef GC_THREAD_SAFE
+#include <mutex>
+#include <shared_mutex>
+#endif
+
+template <class T> struct GCRelocatable : std::false_type {};
+
+// Keeps compact() from moving objects while this thread uses them. Guards
+// nest; without GC_THREAD_SAFE they do nothing.
+class GCRelocationGuard {
+public:
+  GCRelocationGuard() {
+#ifdef GC_THREAD_SAFE
+    // Through the turnstile, so that a waiting compact() goes first.
+    if (depth()++ == 0) {
+      std::lock_guard<std::mutex> turn(turnstile());
+      mutex().lock_shared();
+    }
+#endif
+  }
+  ~GCRelocationGuard() {
+#ifdef GC_THREAD_SAFE
+    if (--depth() == 0)
+      mutex().unlock_shared();
+#endif
+  }
+  GCRelocationGuard(const GCRelocationGuard &) = delete;
+  GCRelocationGuard &operator=(const GCRelocationGuard &) = delete;
+  // Whether this thread may dereference relocatable Pointers.
+  static bool held() {
+#ifdef GC_THREAD_SAFE
+    return depth() > 0;
+#else
+    return true;
+#endif
+  }
+#ifdef GC_THREAD_SAFE
+  // Waits for every guard to go, and keeps new ones out, until the
+  // returned lock is released. For compact().
+  static std::unique_lock<std::shared_mutex> exclusive() {
+    std::lock_guard<std::mutex> turn(turnstile());
+    return std::unique_lock<std::shared_mutex>(mutex());
+  }
+
+private:
+  static std::shared_mutex &mutex() {
+    static std::shared_mutex m;
+    return m;
+  }
+  static std::mutex &turnstile() {
+    static std::mutex m;
+    return m;
+  }
+  static unsigned &depth() {
+    thread_local unsigned d = 0;
+    return d;
+  }
+#endif
+};
+
+// A block of pages that compact() fills with objects. Each page counts
+// the blocks on it; pages whose count drops to 0 are committed but
+// unused, and decommit() hands them back to the OS (see gc_scavenge.h).
+class GCRegion {
+public:
+  // A region with room for bytes bytes of objects, or null if the memory
+  // cannot be had.
+  static GCRegion *create(std::size_t bytes) {
+    std::size_t page = pageSize();
+    // The header holds a counter per page, so grows with the region.
+    std::size_t pages = 1, start, size;
+    for (;;) {
+      start = (sizeof(GCRegion) + pages * sizeof(std::uint32_t) + 63) &
+              ~(std::size_t)63;
+      size = (start + bytes + page - 1) / page * page;
+      if (size / page <= pages)
+        break;
+      pages = size / page;
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+      return nullptr;
+#else
+    void *m = std::malloc(size);
+    if (!m)
+      return nullptr;
+#endif
+    GCRegion *r = ::new (m) GCRegion();
+    r->size = size;
+    r->live = 0;
+    r->start = start;
+    r->top = start;
+    r->used = 0;
+    r->released = 0;
+    std::memset(r->counts(), 0, (size / page) * sizeof(std::uint32_t));
+    Totals &t = totals();
+    r->prev = nullptr;
+    r->next = t.first;
+    if (t.first)
+      t.first->prev = r;
+    t.first = r;
+    t.regions++;
+    t.bytes += size;
+    return r;
+  }
+  // Room for one more block. Regions are filled once, right after
+  // create(), with no more than the bytes asked for there.
+  void *take(std::size_t bytes, std::size_t align) {
+    top = (top + align - 1) / align * align;
+    void *p = reinterpret_cast<unsigned char *>(this) + top;
+    count(top, bytes, 1);
+    top += bytes;
+    live++;
+    used += bytes;
+    totals().used += bytes;
+    return p;
+  }
+  // The block of bytes bytes at p is gone; the last one unmaps the region.
+  void drop(const void *p, std::size_t bytes) {
+    count((std::size_t)(static_cast<const unsigned char *>(p) -
+                        reinterpret_cast<unsigned char *>(this)),
+          bytes, -1);
+    used -= bytes;
+    totals().used -= bytes;
+    if (--live > 0)
+      return;
+    Totals &t = totals();
+    if (prev)
+      prev->next = next;
+    else
+      t.first = next;
+    if (next)
+      next->prev = prev;
+    t.regions--;
+    t.bytes -= size;
+#if defined(__unix__) || defined(__APPLE__)
+    munmap(this, size);
+#else
+    std::free(this);
+#endif
+  }
+  // Decommits the pages no block is on, in every region, until no more
+  // than retain bytes of them stay committed. Returns the bytes given
+  // back. The caller holds the collector lock.
+  static std::size_t decommit(std::size_t retain) {
+    std::size_t empty = emptyBytes(), freed = 0;
+    for (GCRegion *r = totals().first; r && empty > retain; r = r->next)
+      freed += r->decommitPages(empty - retain, empty);
+    return freed;
+  }
+  // The region p is in. There are only a few, one per compaction
+  // that still has blocks left.
+  static GCRegion *owner(const void *p) {
+    const unsigned char *b = static_cast<const unsigned char *>(p);
+    GCRegion *r = totals().first;
+    while (r && (b < reinterpret_cast<unsigned char *>(r) ||
+                 b >= reinterpret_cast<unsigned char *>(r) + r->size))
+      r = r->next;
+    return r;
+  }
+  // Regions mapped, and their size in bytes.
+  static std::size_t regions() { return totals().regions; }
+  static std::size_t bytes() { return totals().bytes; }
+  // Bytes of the live blocks in regions.
+  static std::size_t usedBytes() { return totals().used; }
+  // Bytes of the pages blocks were placed on, less those decommitted:
+  // what the regions hold of the OS's memory, used or not.
+  static std::size_t committedBytes() {
+    std::size_t page = pageSize(), committed = 0;
+    for (GCRegion *r = totals().first; r; r = r->next)
+      committed += (r->top + page - 1) / page * page - r->released;
+    return committed;
+  }
+  // Committed bytes on pages no block is on any more.
+  static std::size_t emptyBytes() {
+    std::size_t page = pageSize(), empty = 0;
+    for (GCRegion *r = totals().first; r; r = r->next)
+      for (std::size_t i = r->firstPage(); i < r->endPage(); i++)
+        if (r->counts()[i] == 0)
+          empty += page;
+    return empty;
+  }
+
+  // Frees memory that new T or new T[n] returned, once the objects in it
+  // have been destroyed.
+  template <class T> static void freeNew(void *block, bool isArray) {
+#ifdef __cpp_aligned_new
+    if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      if (isArray)
+        ::operator delete[](block, std::align_val_t(alignof(T)));
+      else
+        ::operator delete(block, std::align_val_t(alignof(T)));
+      return;
+    }
+#endif
+    if (isArray)
+      ::operator delete[](block);
+    else
+      ::operator delete(block);
+  }
+
+private:
+  // Marks a page decommitted; its count never rises again, since blocks
+  // are only placed right after create().
+  static const std::uint32_t DECOMMITTED = 0x80000000u;
+
+  GCRegion *prev, *next; // all regions, newest first
+  std::size_t size;      // bytes mapped, this header included
+  std::size_t live;      // blocks not freed yet
+  std::size_t start;     // offset of the first block, past the counters
+  std::size_t top;       // offset of the first free byte
+  std::size_t used;      // bytes of the live blocks
+  std::size_t released;  // bytes decommitted
+  struct Totals {
+    GCRegion *first;
+    std::size_t regions, bytes, used;
+  };
+  static Totals &totals() {
+    static Totals t;
+    return t;
+  }
+  static std::size_t pageSize() {
+#if defined(__unix__) || defined(__APPLE__)
+    static std::size_t page = (std::size_t)sysconf(_SC_PAGESIZE);
+    return page;
+#else
+    return 4096;
+#endif
+  }
+  std::uint32_t *counts() {
+    return reinterpret_cast<std::uint32_t *>(
+        reinterpret_cast<unsigned char *>(this) + sizeof(GCRegion));
+  }
+  // Pages that may go back: those past the header and below top.
+  std::size_t firstPage() const {
+    return (start + pageSize() - 1) / pageSize();
+  }
+  std::size_t endPage() const { return (top + pageSize() - 1) / pageSize(); }
+  // Adds delta to the count of every page [offset, offset + bytes) is on.
+  void count(std::size_t offset, std::size_t bytes, int delta) {
+    std::size_t page = pageSize();
+    std::size_t last = (offset + (bytes ? bytes : 1) - 1) / page;
+    for (std::size_t i = offset / page; i <= last; i++)
+      counts()[i] += (std::uint32_t)delta;
+  }
+  // Decommits runs of empty pages, up to want bytes; empty is the total
+  // left committed, kept up to date.
+  std::size_t decommitPages(std::size_t want, std::size_t &empty) {
+    std::size_t page = pageSize(), freed = 0;
+    std::uint32_t *c = counts();
+    std::size_t i = firstPage(), end = endPage();
+    while (i < end && freed < want) {
+      if (c[i] != 0) {
+        i++;
+        continue;
+      }
+      std::size_t run = i;
+      while (run < end && c[run] == 0 && freed + (run - i) * page < want)
+        run++;
+      unsigned char *from = reinterpret_cast<unsigned char *>(this) + i * page;
+#if defined(MADV_FREE) && defined(GC_DECOMMIT_LAZY)
+      // The kernel takes the pages back when it needs them.
+      madvise(from, (run - i) * page, MADV_FREE);
+#elif defined(__unix__) || defined(__APPLE__)
+      madvise(from, (run - i) * page, MADV_DONTNEED);
+#endif
+      for (std::size_t k = i; k < run; k++)
+        c[k] = DECOMMITTED;
+      freed += (run - i) * page;
+      i = run;
+    }
+    released += freed;
+    empty -= freed;
+    return freed;
+  }
+};
+
+// The deleter compact() gives the blocks it moves: destroys the count
+// elements and lets their region know. It finds the region from the
+// address, so that it fits in the deleter buffer of PtrDetails.
+template <class T> struct GCRegionDeleter {
+  unsigned count;
+  void operator()(T *p) {
+    for (unsigned i = count; i > 0; i--)
+      p[i - 1].~T();
+    GCRegion::owner(p)->drop(p, sizeof(T) * count);
+  }
+};
@@ -1,18 +1,76 @@
-// This class defines an element that is stored
-// in the garbage collection information list.
-template <class T> class PtrDetails {
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Bytes a custom deleter may take inside its PtrDetails. Larger
+// deleters, or ones that are not trivially copyable, are kept on
+// the heap and the buffer holds a pointer to them. Every entry
+// pays for the buffer, so it is one word: enough for the
+// deleters of large arrays, compacted blocks and allocate_gc()
+// with a stateless allocator.
+#ifndef GC_DELETER_BUFFER
+#define GC_DELETER_BUFFER sizeof(void *)
+#endif
+
+// The part of a garbage collection list element that does not
+// depend on the pointee type. Pointers to a base class or to a
+// subobject refer to the element of the owning allocation through
+// it, so every allocation has one count and is freed once.
+class PtrDetailsBase {
 public:
   unsigned refCount;  // current reference count
-  T * memPtr;          // pointer to allocated memory
+  unsigned weakCount; // number of WeakPointers to this entry
   bool isArray;       // true if pointing to array
   unsigned arraySize; // If memPtr is pointing to an allocated array size of array
+  bool expired;       // true once the memory has been freed
+  bool relocated;     // memory moved by compact() (see gc_compact.h)
+  bool large;         // memory from the large-object space (gc_large.h)
+  // collect() of the Pointer type that owns this element, so that
+  // Pointers of other types can have the memory freed when they let
+  // go of the last reference.
+  bool (*collectOwner)();
+
+  // Just increments the reference count for the address this instance is
+  // storing information for.
+  void upRefCount() {refCount ++;} 
+  // Decreases the same reference count.
+  void downRefCount() {refCount --;}
+  // Tells whether there ar no references to this address so that it can 
+  // be deleted.
+  bool zeroRefCount() {return refCount == 0;}
+  // The same for references from WeakPointers, which keep this entry (but
+  // not the memory) around.
+  void upWeakCount() {weakCount ++;}
+  void downWeakCount() {weakCount --;}
+  bool zeroWeakCount() {return weakCount == 0;}
+};
+
+// This class defines an element that is stored
+// in the garbage collection information list.
+template <class T> class PtrDetails : public PtrDetailsBase {
+public:
+  T * memPtr;          // pointer to allocated memory
+  // Frees memPtr (if not null) with the custom deleter, then the
+  // deleter itself; null means delete or delete[].
+  void (*release)(unsigned char *deleter, T *memPtr);
+  // The custom deleter, or a pointer to it (see GC_DELETER_BUFFER).
+  alignas(void *) unsigned char deleter[GC_DELETER_BUFFER];
+  static_assert(GC_DELETER_BUFFER >= sizeof(void *),
+                "GC_DELETER_BUFFER must have room for a pointer");
 
-  PtrDetails<T>(T * ptr, unsigned size = 0) {
+  PtrDetails(T * ptr, unsigned size = 0) {
     // Assign the pointer.
     memPtr = ptr;
+    expired = false;
+    relocated = false;
+    large = false;
+    collectOwner = nullptr;
+    release = nullptr;
     // The first time a PtrDetails object is created, there is just
     // one pointer pointing at the address stored within.
     refCount = 1;
+    weakCount = 0;
     if (size > 0) {
       // Size longer than zero means the pointer is pointing at an array.
       isArray = true;
@@ -25,23 +83,104 @@ public:
   } 
 
   // Copy constructor
-  PtrDetails<T>(const PtrDetails &ob) {
+  PtrDetails(const PtrDetails &ob) {
     // First, update the reference count for that memory block.
     // The object exists
     // Then we copy all the member instance info.
+    refCount = ob.refCount;
+    weakCount = ob.weakCount;
     memPtr = ob.memPtr;
     isArray = ob.isArray;
     arraySize = ob.arraySize;
+    expired = ob.expired;
+    relocated = ob.relocated;
+    large = ob.large;
+    collectOwner = ob.collectOwner;
+    // Deleters in the buffer are trivially copyable; heap ones are
+    // shared with ob.
+    release = ob.release;
+    std::memcpy(deleter, ob.deleter, sizeof deleter);
   }
 
-  // Just increments the reference count for the address this instance is
-  // storing information for.
-  void upRefCount() {refCount ++;} 
-  // Decreases the same reference count.
-  void downRefCount() {refCount --;}
-  // Tells whether there ar no references to this address so that it can 
-  // be deleted.
-  bool zeroRefCount() {return refCount == 0;}
+  // A deleter in the form an entry keeps it. makeDeleter() does
+  // what may fail (allocating a deleter that does not fit in the
+  // buffer), so that it can be done before the entry is found or
+  // added; adoptDeleter() then cannot fail.
+  struct Deleter {
+    void (*release)(unsigned char *, T *);
+    alignas(void *) unsigned char storage[GC_DELETER_BUFFER];
+  };
+  template <class D> static Deleter makeDeleter(D d) {
+    Deleter stored;
+    storeDeleter(stored, std::move(d), Inline<D>());
+    return stored;
+  }
+  // Free a deleter no entry adopted.
+  static void discardDeleter(Deleter &d) {
+    if (d.release)
+      d.release(d.storage, nullptr);
+    d.release = nullptr;
+  }
+  // Free memPtr with d instead of delete or delete[], which is
+  // left empty. A deleter set before is freed without being called.
+  void adoptDeleter(Deleter &d) {
+    Deleter old;
+    old.release = release;
+    std::memcpy(old.storage, deleter, sizeof deleter);
+    release = d.release;
+    std::memcpy(deleter, d.storage, sizeof deleter);
+    d.release = nullptr;
+    discardDeleter(old);
+  }
+  // Free memPtr with d(memPtr).
+  template <class D> void setDeleter(D d) {
+    Deleter stored = makeDeleter(std::move(d));
+    adoptDeleter(stored);
+  }
+  // Free memPtr with the deleter, then the deleter.
+  void runDeleter() {
+    release(deleter, memPtr);
+    release = nullptr;
+  }
+  // The deleter, wherever it is kept, or null if it is not a D.
+  template <class D> D *getDeleter() {
+    if (release == &releaseStored<D>)
+      return reinterpret_cast<D *>(deleter);
+    if (release != &releaseHeap<D>)
+      return nullptr;
+    D *heap;
+    std::memcpy(&heap, deleter, sizeof heap);
+    return heap;
+  }
+
+private:
+  // Whether a D is kept in deleter itself.
+  template <class D>
+  using Inline = std::integral_constant<bool, sizeof(D) <= sizeof deleter &&
+                                                  alignof(D) <= alignof(void *) &&
+                                                  std::is_trivially_copyable<D>::value>;
+  template <class D>
+  static void storeDeleter(Deleter &stored, D d, std::true_type) {
+    ::new ((void *)stored.storage) D(std::move(d));
+    stored.release = &releaseStored<D>;
+  }
+  template <class D>
+  static void storeDeleter(Deleter &stored, D d, std::false_type) {
+    D *heap = new D(std::move(d));
+    std::memcpy(stored.storage, &heap, sizeof heap);
+    stored.release = &releaseHeap<D>;
+  }
+  template <class D> static void releaseStored(unsigned char *deleter, T *memPtr) {
+    if (memPtr)
+      (*reinterpret_cast<D *>(deleter))(memPtr);
+  }
+  template <class D> static void releaseHeap(unsigned char *deleter, T *memPtr) {
+    D *heap;
+    std::memcpy(&heap, deleter, sizeof heap);
+    if (memPtr)
+      (*heap)(memPtr);
+    delete heap;
+  }
 };
 
 // Overloading operator== allows two class objects to be compared (needed by STL list).
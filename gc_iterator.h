@@ -1,3 +1,7 @@
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+
 // Exception thrown when an attempt is made to
 // use an Iter that exceeds the range of the
 // underlying object.
@@ -6,14 +10,21 @@ class OutOfRangeExc {
   // Add functionality if needed by your application.
 };
 
-// An iterator-like class for cycling through arrays
-// that are pointed to by GCPtrs. Iter pointers
-// ** do not ** participate in or affect garbage
-// collection. Thus, an Iter pointing to
+// A random-access iterator for cycling through arrays
+// that are pointed to by GCPtrs, usable with the
+// standard algorithms (including the C++17 parallel
+// ones). Iter pointers ** do not ** participate in or
+// affect garbage collection. Thus, an Iter pointing to
 // some object does not prevent that object
 // from being recycled.
 //
-template <class T> class Iter {
+// With Checked true, every access is checked against
+// the bounds of the array. Those checks keep the compiler
+// from vectorizing loops, so Pointer::begin() and end()
+// return unchecked Iters; convert them to a CheckedIter
+// to have them checked.
+//
+template <class T, bool Checked = false> class Iter {
   T *ptr;
   // current pointer value
   T *end;
@@ -21,7 +32,21 @@ template <class T> class Iter {
 
   T *begin;        // points to start of allocated array
   unsigned length; // length of sequence
+  template <class U, bool C> friend class Iter;
 public:
+  typedef std::random_access_iterator_tag iterator_category;
+#if __cplusplus > 201703L
+  // A checked operator-> throws at end(), which std::to_address()
+  // on a contiguous iterator must not do.
+  typedef typename std::conditional<Checked, std::random_access_iterator_tag,
+                                    std::contiguous_iterator_tag>::type
+      iterator_concept;
+#endif
+  typedef typename std::remove_cv<T>::type value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef T *pointer;
+  typedef T &reference;
+
   Iter() {
     ptr = end = begin = nullptr; // Isntead of using NULL we use the standard nullptr.
     length = 0;
@@ -32,70 +57,80 @@ public:
     begin = first;
     length = last - first;
   }
+  // Convert between checked and unchecked Iters.
+  template <bool C>
+  Iter(const Iter<T, C> &itr)
+      : ptr(itr.ptr), end(itr.end), begin(itr.begin), length(itr.length) {}
   // Return length of sequence to which this
   // Iter points.
-  unsigned size() { return length; }
+  unsigned size() const { return length; }
   // Return value pointed to by ptr.
   // Do not allow out-of-bounds access.
-  T &operator*() {
-    if ((ptr >= end) || (ptr < begin))
+  T &operator*() const {
+    if (Checked && ((ptr >= end) || (ptr < begin)))
       throw OutOfRangeExc();
     return *ptr;
   }
   // Return address contained in ptr.
   // Do not allow out-of-bounds access.
-  T *operator->() {
-    if ((ptr >= end) || (ptr < begin))
+  T *operator->() const {
+    if (Checked && ((ptr >= end) || (ptr < begin)))
       throw OutOfRangeExc();
     return ptr;
   }
   // Prefix ++.
-  Iter operator++() {
+  Iter &operator++() {
     ptr++;
     return *this;
   }
   // Prefix --.
-  Iter operator--() {
+  Iter &operator--() {
     ptr--;
     return *this;
   }
   // Postfix ++.
-  Iter operator++(int notused) {
-    T *tmp = ptr;
+  Iter operator++(int) {
+    Iter tmp = *this;
     ptr++;
-    return Iter<T>(tmp, begin, end);
+    return tmp;
   }
   // Postfix --.
-  Iter operator--(int notused) {
-    T *tmp = ptr;
+  Iter operator--(int) {
+    Iter tmp = *this;
     ptr--;
-    return Iter<T>(tmp, begin, end);
+    return tmp;
   }
-  // Return a reference to the object at the
-  // specified index. Do not allow out-of-bounds
-  // access.
-  T &operator[](int i) {
-    if ((i < 0) || (i >= (end - begin)))
+  // Return a reference to the object n elements
+  // away, like *(*this + n). Do not allow
+  // out-of-bounds access.
+  T &operator[](difference_type n) const {
+    if (Checked && ((ptr + n < begin) || (ptr + n >= end)))
       throw OutOfRangeExc();
-    return ptr[i];
+    return ptr[n];
   }
   // Define the relational operators.
-  bool operator==(Iter op2) { return ptr == op2.ptr; }
-  bool operator!=(Iter op2) { return ptr != op2.ptr; }
-  bool operator<(Iter op2) { return ptr < op2.ptr; }
-  bool operator<=(Iter op2) { return ptr <= op2.ptr; }
-  bool operator>(Iter op2) { return ptr > op2.ptr; }
-  bool operator>=(Iter op2) { return ptr >= op2.ptr; }
-  // Subtract an integer from an Iter.
-  Iter operator-(int n) {
-    ptr -= n;
+  bool operator==(const Iter &op2) const { return ptr == op2.ptr; }
+  bool operator!=(const Iter &op2) const { return ptr != op2.ptr; }
+  bool operator<(const Iter &op2) const { return ptr < op2.ptr; }
+  bool operator<=(const Iter &op2) const { return ptr <= op2.ptr; }
+  bool operator>(const Iter &op2) const { return ptr > op2.ptr; }
+  bool operator>=(const Iter &op2) const { return ptr >= op2.ptr; }
+  // Move this Iter by n elements.
+  Iter &operator+=(difference_type n) {
+    ptr += n;
     return *this;
   }
-  // Add an integer to an Iter.
-  Iter operator+(int n) {
-    ptr += n;
+  Iter &operator-=(difference_type n) {
+    ptr -= n;
     return *this;
   }
+  // Return an Iter n elements after or before this one.
+  Iter operator+(difference_type n) const { return Iter(ptr + n, begin, end); }
+  Iter operator-(difference_type n) const { return Iter(ptr - n, begin, end); }
+  friend Iter operator+(difference_type n, const Iter &itr) { return itr + n; }
   // Return number of elements between two Iters.
-  int operator-(Iter<T> &itr2) { return ptr - itr2.ptr; }
+  difference_type operator-(const Iter &itr2) const { return ptr - itr2.ptr; }
 };
+
+// An Iter that checks every access.
+template <class T> using CheckedIter = Iter<T, true>;
@@ -0,0 +1,177 @@
+// Large-object space. make_gc_array() takes arrays of GC_LARGE_OBJECT
+// bytes or more straight from mmap instead of new[]: each gets its own
+// mapping, starting on a GC_LARGE_ALIGN (2 MiB) boundary and hinted with
+// MADV_HUGEPAGE, so that transparent huge pages can back it and walking
+// it takes fewer TLB misses. Freed arrays keep their mapping, up to
+// GC_LARGE_CACHE bytes, for the next large array that fits, since
+// mapping fresh memory costs a page fault per page touched; the
+// scavenger (gc_scavenge.h) unmaps them. Pointer keeps these blocks apart
+// from the small ones, so that collectLarge() can free them without
+// sweeping every small block. Where mmap is missing, or once
+// GC_LARGE_OBJECTS blocks are mapped, large arrays come from new[] as
+// before.
+#include <cstddef>
+#include <cstdint>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifndef GC_LARGE_OBJECT
+#define GC_LARGE_OBJECT (2 << 20) // smallest array, in bytes, mapped alone
+#endif
+#ifndef GC_LARGE_ALIGN
+#define GC_LARGE_ALIGN (2 << 20) // alignment of large arrays (a huge page)
+#endif
+#ifndef GC_LARGE_OBJECTS
+#define GC_LARGE_OBJECTS 4096 // large arrays mapped at once, at most
+#endif
+#ifndef GC_LARGE_CACHE
+#define GC_LARGE_CACHE (64 << 20) // bytes of freed mappings kept for reuse
+#endif
+
+class GCLargeObjects {
+public:
+  // Whether an array of bytes bytes aligned to align belongs here.
+  static bool wanted(std::size_t bytes, std::size_t align) {
+    return bytes >= GC_LARGE_OBJECT && align <= GC_LARGE_ALIGN;
+  }
+  // Maps bytes bytes on a GC_LARGE_ALIGN boundary, or returns null. The
+  // memory may be reused and is not zeroed. The caller holds the
+  // collector lock.
+  static void *allocate(std::size_t bytes) {
+#if defined(__unix__) || defined(__APPLE__)
+    Registry &r = registry();
+    if (r.count == GC_LARGE_OBJECTS || bytes == 0)
+      return nullptr;
+    std::size_t page = (std::size_t)sysconf(_SC_PAGESIZE);
+    std::size_t size = (bytes + page - 1) / page * page;
+    // A cached mapping no more than a huge page too long.
+    for (std::size_t i = r.count; i < r.count + r.cached; i++)
+      if (r.blocks[i].size >= size &&
+          r.blocks[i].size - size < GC_LARGE_ALIGN) {
+        Block b = r.blocks[i];
+        r.blocks[i] = r.blocks[r.count];
+        r.blocks[r.count++] = b;
+        r.cached--;
+        r.cachedBytes -= b.size;
+        r.bytes += b.size;
+        return b.addr;
+      }
+    if (r.count + r.cached == GC_LARGE_OBJECTS)
+      unmap(r.count + r.cached - 1);
+    // Map enough to find an aligned start, then unmap the slack on
+    // either side; the tail is only cut to the page.
+    std::size_t slack = GC_LARGE_ALIGN > page ? GC_LARGE_ALIGN - page : 0;
+    void *m = mmap(nullptr, size + slack, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+      return nullptr;
+    std::uintptr_t base = (std::uintptr_t)m;
+    std::uintptr_t start = (base + GC_LARGE_ALIGN - 1) &
+                           ~(std::uintptr_t)(GC_LARGE_ALIGN - 1);
+    if (start > base)
+      munmap(m, start - base);
+    if (base + size + slack > start + size)
+      munmap((void *)(start + size), base + size + slack - (start + size));
+#ifdef MADV_HUGEPAGE
+    // Only a hint: the kernel may have transparent huge pages off.
+    madvise((void *)start, size, MADV_HUGEPAGE);
+#endif
+    // The first cached block moves to the end to make room.
+    r.blocks[r.count + r.cached] = r.blocks[r.count];
+    r.blocks[r.count].addr = (void *)start;
+    r.blocks[r.count].size = size;
+    r.count++;
+    r.bytes += size;
+    return (void *)start;
+#else
+    (void)bytes;
+    return nullptr;
+#endif
+  }
+  // Takes back a block allocate() returned, keeping its mapping if the
+  // cache has room. The caller holds the lock.
+  static void release(void *p) {
+    Registry &r = registry();
+    std::size_t i = find(p);
+    if (i == r.count)
+      return;
+    // Swap it to the end of the live blocks, where the cache starts.
+    Block b = r.blocks[i];
+    r.blocks[i] = r.blocks[--r.count];
+    r.blocks[r.count] = b;
+    r.cached++;
+    r.cachedBytes += b.size;
+    r.bytes -= b.size;
+    if (r.cachedBytes > GC_LARGE_CACHE)
+      unmap(r.count);
+  }
+  // Unmaps cached mappings until no more than retain bytes are left.
+  // Returns the bytes unmapped. The caller holds the lock.
+  static std::size_t trim(std::size_t retain) {
+    Registry &r = registry();
+    std::size_t freed = 0;
+    while (r.cached > 0 && r.cachedBytes > retain) {
+      freed += r.blocks[r.count].size;
+      unmap(r.count);
+    }
+    return freed;
+  }
+  // Whether p is the start of a block allocate() returned.
+  static bool contains(const void *p) {
+    // Small blocks are seldom aligned this far, so most lookups stop here.
+    if ((std::uintptr_t)p % GC_LARGE_ALIGN != 0)
+      return false;
+    return find(p) != registry().count;
+  }
+  // Live blocks, and the bytes mapped for them.
+  static std::size_t objects() { return registry().count; }
+  static std::size_t bytes() { return registry().bytes; }
+  // Bytes of freed mappings kept for reuse.
+  static std::size_t cachedBytes() { return registry().cachedBytes; }
+
+private:
+  struct Block {
+    void *addr;
+    std::size_t size; // bytes mapped
+  };
+  // Trivially destructible, so blocks freed by static Pointers at exit
+  // still find it. The count live blocks come first in blocks, then the
+  // cached ones.
+  struct Registry {
+    std::size_t count, bytes, cached, cachedBytes;
+    Block blocks[GC_LARGE_OBJECTS];
+  };
+  static Registry &registry() {
+    static Registry r;
+    return r;
+  }
+  // Unmaps cached block i.
+  static void unmap(std::size_t i) {
+    Registry &r = registry();
+#if defined(__unix__) || defined(__APPLE__)
+    munmap(r.blocks[i].addr, r.blocks[i].size);
+#endif
+    r.cachedBytes -= r.blocks[i].size;
+    r.blocks[i] = r.blocks[r.count + --r.cached];
+  }
+  static std::size_t find(const void *p) {
+    Registry &r = registry();
+    std::size_t i = 0;
+    while (i < r.count && r.blocks[i].addr != p)
+      i++;
+    return i;
+  }
+};
+
+// The deleter make_gc_array() gives large arrays: destroys the count
+// elements and hands the mapping back.
+template <class T> struct GCLargeDeleter {
+  unsigned count;
+  void operator()(T *p) {
+    for (unsigned i = count; i > 0; i--)
+      p[i - 1].~T();
+    GCLargeObjects::release(p);
+  }
+};
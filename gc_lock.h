@@ -0,0 +1,22 @@
+// Build switches shared by every Pointer type.
+#ifdef GC_THREAD_SAFE
+#include <mutex>
+#endif
+
+// Define GC_THREAD_SAFE to share Pointers between threads. All
+// Pointer types then take one process-wide lock around their
+// bookkeeping; it cannot be per type, because converted Pointers
+// update entries in other types' refContainers. It is recursive
+// since collect() runs destructors of objects holding Pointers.
+#ifdef GC_THREAD_SAFE
+inline std::recursive_mutex &gcMutex() {
+  static std::recursive_mutex m;
+  return m;
+}
+#define GC_LOCK() std::lock_guard<std::recursive_mutex> gcLock(gcMutex())
+#else
+#define GC_LOCK()
+#endif
+
+// Define GC_QUIET to stop Pointer's destructor from printing
+// refContainer before and after each collection.
@@ -0,0 +1,232 @@
+// Hardware counters for the collector. With GC_PERF defined, collect()
+// and each of its sweeps and finalize batches read cycles, instructions,
+// last-level cache misses and branch misses through perf_event_open(2),
+// and so do one in GC_PERF_SAMPLE calls of the Pointer hot paths
+// (findPtrInfo, construction, copy and destruction). The differences are
+// added to per-phase totals that GCPerf::stats() returns and
+// GCPerf::report() prints. Phases nest: "collect" includes its sweeps
+// and finalize batches, and "destroy" includes the collect() it runs.
+// Each thread opens its own counter group on first use; counters the
+// kernel refuses (no PMU, as in most VMs and containers, or
+// perf_event_paranoid > 2) read as zero and GCPerf::available() says so.
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef GC_PERF_SAMPLE
+#define GC_PERF_SAMPLE 64 // hot path calls per measured call
+#endif
+
+struct GCPerfStats {
+  unsigned long long samples; // measured calls
+  unsigned long long cycles;
+  unsigned long long instructions;
+  unsigned long long cacheMisses; // last-level cache
+  unsigned long long branchMisses;
+};
+
+class GCPerf {
+public:
+  enum Phase { COLLECT, SWEEP, FINALIZE, FIND, CONSTRUCT, COPY, DESTROY, PHASES };
+  enum Counter { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, COUNTERS };
+
+  static const char *name(Phase phase) {
+    static const char *names[PHASES] = {"collect", "sweep", "finalize",
+                                        "findPtrInfo", "construct", "copy",
+                                        "destroy"};
+    return names[phase];
+  }
+  // Whether the calling thread could open the counter.
+  static bool available(Counter counter) {
+    return group().index[counter] >= 0;
+  }
+  static bool available() {
+    for (int c = 0; c < COUNTERS; c++)
+      if (available(Counter(c)))
+        return true;
+    return false;
+  }
+  // Totals over all threads since the start or the last reset().
+  static GCPerfStats stats(Phase phase) {
+    Totals &t = totals()[phase];
+    GCPerfStats s;
+    s.samples = t.samples.load(std::memory_order_relaxed);
+    s.cycles = t.values[CYCLES].load(std::memory_order_relaxed);
+    s.instructions = t.values[INSTRUCTIONS].load(std::memory_order_relaxed);
+    s.cacheMisses = t.values[CACHE_MISSES].load(std::memory_order_relaxed);
+    s.branchMisses = t.values[BRANCH_MISSES].load(std::memory_order_relaxed);
+    return s;
+  }
+  static void reset() {
+    for (int p = 0; p < PHASES; p++) {
+      totals()[p].samples.store(0, std::memory_order_relaxed);
+      for (int c = 0; c < COUNTERS; c++)
+        totals()[p].values[c].store(0, std::memory_order_relaxed);
+    }
+  }
+  // Prints the totals as CSV, one line per phase, with instructions per
+  // cycle and per-sample averages. Unavailable counters are left empty.
+  static void report(std::FILE *out) {
+    std::fprintf(out, "phase,samples,cycles,instructions,llc_misses,"
+                      "branch_misses,ipc,cycles_per_sample,"
+                      "llc_misses_per_sample\n");
+    for (int p = 0; p < PHASES; p++) {
+      GCPerfStats s = stats(Phase(p));
+      unsigned long long values[COUNTERS] = {s.cycles, s.instructions,
+                                             s.cacheMisses, s.branchMisses};
+      std::fprintf(out, "%s,%llu", name(Phase(p)), s.samples);
+      for (int c = 0; c < COUNTERS; c++) {
+        if (available(Counter(c)))
+          std::fprintf(out, ",%llu", values[c]);
+        else
+          std::fputc(',', out);
+      }
+      if (available(CYCLES) && available(INSTRUCTIONS) && s.cycles)
+        std::fprintf(out, ",%.2f", double(s.instructions) / s.cycles);
+      else
+        std::fputc(',', out);
+      if (available(CYCLES) && s.samples)
+        std::fprintf(out, ",%.0f", double(s.cycles) / s.samples);
+      else
+        std::fputc(',', out);
+      if (available(CACHE_MISSES) && s.samples)
+        std::fprintf(out, ",%.2f", double(s.cacheMisses) / s.samples);
+      else
+        std::fputc(',', out);
+      std::fputc('\n', out);
+    }
+  }
+
+  // Current counter values of the calling thread; false if none is open.
+  static bool read(unsigned long long values[COUNTERS]) {
+    Group &g = group();
+    if (g.leader < 0)
+      return false;
+    // PERF_FORMAT_GROUP: the number of counters, then their values in
+    // the order they joined the group.
+    unsigned long long buffer[1 + COUNTERS];
+#ifdef __linux__
+    if (::read(g.leader, buffer, sizeof(buffer)) < (long)sizeof(buffer[0]))
+      return false;
+#else
+    return false;
+#endif
+    for (int c = 0; c < COUNTERS; c++)
+      values[c] = g.index[c] >= 0 && (unsigned long long)g.index[c] < buffer[0]
+                      ? buffer[1 + g.index[c]]
+                      : 0;
+    return true;
+  }
+  static void add(Phase phase, const unsigned long long before[COUNTERS],
+                  const unsigned long long after[COUNTERS]) {
+    Totals &t = totals()[phase];
+    t.samples.fetch_add(1, std::memory_order_relaxed);
+    for (int c = 0; c < COUNTERS; c++)
+      t.values[c].fetch_add(after[c] - before[c], std::memory_order_relaxed);
+  }
+  // Counts calls of a hot path on this thread; true for every
+  // GC_PERF_SAMPLE-th.
+  static bool sample(Phase phase) {
+    thread_local unsigned calls[PHASES];
+    if (++calls[phase] < GC_PERF_SAMPLE)
+      return false;
+    calls[phase] = 0;
+    return true;
+  }
+
+private:
+  struct Totals {
+    std::atomic<unsigned long long> samples;
+    std::atomic<unsigned long long> values[COUNTERS];
+  };
+  // The counters of one thread, closed when the thread exits.
+  struct Group {
+    int leader;
+    int fds[COUNTERS];
+    int index[COUNTERS]; // position in the group read, -1 if not open
+    Group() : leader(-1) {
+      int joined = 0;
+      for (int c = 0; c < COUNTERS; c++) {
+        fds[c] = open(Counter(c), leader);
+        index[c] = fds[c] >= 0 ? joined++ : -1;
+        if (fds[c] >= 0 && leader < 0)
+          leader = fds[c];
+      }
+    }
+    ~Group() {
+#ifdef __linux__
+      for (int c = 0; c < COUNTERS; c++)
+        if (fds[c] >= 0)
+          close(fds[c]);
+#endif
+    }
+    Group(const Group &) = delete;
+    Group &operator=(const Group &) = delete;
+  };
+
+  static Totals *totals() {
+    static Totals t[PHASES];
+    return t;
+  }
+  static Group &group() {
+    thread_local Group g;
+    return g;
+  }
+  // Counts user space only, so that perf_event_paranoid 2 (the default
+  // on most distributions) is enough.
+  static int open(Counter counter, int leader) {
+#ifdef __linux__
+    static const unsigned long long configs[COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[counter];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+#else
+    (void)counter;
+    (void)leader;
+    return -1;
+#endif
+  }
+};
+
+// Adds the counters spent in its lifetime to phase. A sampled scope only
+// reads them on one in GC_PERF_SAMPLE calls.
+class GCPerfScope {
+  GCPerf::Phase phase;
+  bool active;
+  unsigned long long before[GCPerf::COUNTERS];
+public:
+  explicit GCPerfScope(GCPerf::Phase p, bool sampled = false) : phase(p) {
+    active = (!sampled || GCPerf::sample(p)) && GCPerf::read(before);
+  }
+  ~GCPerfScope() {
+    unsigned long long after[GCPerf::COUNTERS];
+    if (active && GCPerf::read(after))
+      GCPerf::add(phase, before, after);
+  }
+};
+
+// The hooks in gc_pointer.h compile to nothing without GC_PERF.
+#ifdef GC_PERF
+#define GC_PERF_CONCAT2(a, b) a##b
+#define GC_PERF_CONCAT(a, b) GC_PERF_CONCAT2(a, b)
+#define GC_PERF_SCOPE(phase)                                                   \
+  GCPerfScope GC_PERF_CONCAT(gcPerfScope, __LINE__)(GCPerf::phase)
+#define GC_PERF_SAMPLED_SCOPE(phase)                                           \
+  GCPerfScope GC_PERF_CONCAT(gcPerfScope, __LINE__)(GCPerf::phase, true)
+#else
+#define GC_PERF_SCOPE(phase)
+#define GC_PERF_SAMPLED_SCOPE(phase)
+#endif
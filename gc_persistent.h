@@ -0,0 +1,532 @@
+// Persistent heap. GCPersistentHeap::open(path, capacity) maps a file,
+// and make_persistent<T>() allocates a T in it and returns a
+// PersistentPointer<T>, which holds the object's offset in the mapping
+// rather than its address, so the file can be mapped anywhere. The list
+// of blocks, the free lists and a table of named roots are kept in the
+// file too: after a restart, open() maps it again and getRoot() returns
+// what the previous run stored with setRoot(), with nothing to rebuild.
+//
+// Blocks are reference counted like Pointer's memory. The count kept in
+// the file is that of the PersistentPointers stored in the heap (members
+// of objects in it, and roots). PersistentPointers anywhere else (the
+// stack, globals, ordinary objects) pin the block for the current run
+// only, so the pins a previous run left behind need no cleanup. A block
+// is destroyed, and its memory reused, when neither refers to it.
+// collect() sweeps the block list for blocks nothing refers to any more,
+// such as those only pinned when the previous run exited; it only frees
+// types this run knows (through make_persistent(), getRoot() or
+// registerType()). Cycles are not reclaimed.
+//
+// Objects in the heap must stay valid at another address and in another
+// process: scalars, arrays and PersistentPointers are fine; raw pointers,
+// references, virtual functions and members owning memory outside the
+// heap (std::string, std::vector) are not. The file is consistent after
+// sync() or close(); a run that crashes may leave counts wrong. One heap
+// is open at a time, and PersistentPointers must be dropped before
+// close(). open() takes an exclusive flock() on the file, so a second
+// process cannot map the heap while it is in use.
+#if defined(__unix__) || defined(__APPLE__)
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef GC_PERSISTENT_ROOTS
+#define GC_PERSISTENT_ROOTS 64 // named roots per heap
+#endif
+#ifndef GC_PERSISTENT_TYPES
+#define GC_PERSISTENT_TYPES 1024 // types one run can free
+#endif
+
+template <class T> class PersistentPointer;
+
+class GCPersistentHeap {
+public:
+  static const std::uint32_t VERSION = 1;
+  static const std::size_t ROOT_NAME = 32; // bytes, with the NUL
+
+  // Maps the heap in path, creating a file of capacity bytes if there is
+  // none (an existing file keeps its size). Returns false if the file
+  // cannot be opened or mapped, is not a heap, a heap is already open, or
+  // another process has this one open.
+  static bool open(const char *path, std::size_t capacity) {
+    GC_LOCK();
+    State &s = state();
+    if (s.base)
+      return false;
+    int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+      return false;
+    // The lock goes with the descriptor, which stays open until close().
+    struct stat st;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    bool created = st.st_size == 0;
+    std::size_t page = (std::size_t)sysconf(_SC_PAGESIZE);
+    std::size_t size = created ? (capacity + page - 1) / page * page
+                               : (std::size_t)st.st_size;
+    void *m = MAP_FAILED;
+    if (size >= first() + BLOCK && (!created || ftruncate(fd, size) == 0))
+      m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    Header &h = *static_cast<Header *>(m);
+    if (created) {
+      std::memcpy(h.magic, magic(), sizeof(h.magic));
+      h.version = VERSION;
+      h.capacity = size;
+      h.top = first();
+    }
+    else if (std::memcmp(h.magic, magic(), sizeof(h.magic)) != 0 ||
+             h.version != VERSION || h.capacity != size) {
+      munmap(m, size);
+      ::close(fd);
+      return false;
+    }
+    s.base = static_cast<unsigned char *>(m);
+    s.size = size;
+    s.fd = fd;
+    s.wasClean = created || h.clean;
+    // A new epoch drops every pin of the previous run.
+    h.epoch++;
+    h.clean = 0;
+    return true;
+  }
+  // Writes the heap back to its file and unmaps it.
+  static bool close() {
+    GC_LOCK();
+    State &s = state();
+    if (!s.base)
+      return false;
+    header().clean = 1;
+    bool ok = msync(s.base, s.size, MS_SYNC) == 0;
+    munmap(s.base, s.size);
+    ok = ::close(s.fd) == 0 && ok;
+    s.base = nullptr;
+    return ok;
+  }
+  // Writes the heap back to its file, leaving it open.
+  static bool sync() {
+    GC_LOCK();
+    State &s = state();
+    return s.base && msync(s.base, s.size, MS_SYNC) == 0;
+  }
+  static bool isOpen() { return state().base != nullptr; }
+  // Whether the previous run closed the heap; if not, counts may be off.
+  static bool wasClean() { return state().wasClean; }
+
+  // Frees the blocks nothing refers to, as many passes as it takes.
+  // Returns the number of blocks freed.
+  static std::size_t collect() {
+    GC_LOCK();
+    State &s = state();
+    if (!s.base || s.collecting)
+      return 0;
+    s.collecting = true;
+    std::size_t freed = 0;
+    // Destructors free blocks themselves and so change the list; the
+    // candidates are gathered first and checked again one by one.
+    std::vector<std::uint64_t> garbage;
+    for (;;) {
+      garbage.clear();
+      for (std::uint64_t b = header().blocks; b; b = block(b).next)
+        if (unreferenced(block(b)) && findType(block(b).type))
+          garbage.push_back(b);
+      std::size_t before = freed;
+      for (std::uint64_t b : garbage)
+        if (block(b).flags == ALLOCATED && unreferenced(block(b))) {
+          destroy(b);
+          freed++;
+        }
+      if (freed == before)
+        break;
+    }
+    s.collecting = false;
+    return freed;
+  }
+
+  // Lets collect() free blocks of type T that an earlier run allocated.
+  template <class T> static void registerType() {
+    GC_LOCK();
+    typeId<T>();
+  }
+
+  // Stores p as the root name, replacing the previous one. A null p
+  // removes the root. Returns false if the root table is full.
+  template <class T>
+  static bool setRoot(const char *name, const PersistentPointer<T> &p) {
+    GC_LOCK();
+    typeId<T>();
+    Root *r = findRoot(name, true);
+    if (!r)
+      return false;
+    std::uint64_t old = r->offset;
+    r->offset = p.off;
+    if (p.off)
+      retain(p.off, true);
+    if (old)
+      release(old, true);
+    if (!r->offset)
+      std::memset(r->name, 0, sizeof(r->name));
+    else if (!old)
+      std::strncpy(r->name, name, ROOT_NAME - 1);
+    return true;
+  }
+  // The root name, or null if there is none or it holds another type.
+  template <class T> static PersistentPointer<T> getRoot(const char *name) {
+    GC_LOCK();
+    std::uint32_t type = typeId<T>();
+    Root *r = findRoot(name, false);
+    if (!r || block(r->offset - BLOCK).type != type)
+      return PersistentPointer<T>();
+    return PersistentPointer<T>(r->offset);
+  }
+
+  // Blocks allocated and the bytes they take, header included.
+  static std::size_t liveBlocks() { return isOpen() ? header().live : 0; }
+  static std::size_t liveBytes() { return isOpen() ? header().liveBytes : 0; }
+  // Bytes of the file handed out so far, and its size.
+  static std::size_t used() { return isOpen() ? header().top : 0; }
+  static std::size_t capacity() { return state().base ? state().size : 0; }
+
+private:
+  template <class T> friend class PersistentPointer;
+  template <class T, class... Args>
+  friend PersistentPointer<T> make_persistent(Args &&...);
+  template <class T>
+  friend PersistentPointer<T> make_persistent_array(std::uint32_t);
+
+  enum Flags { ALLOCATED = 1, DYING = 2 };
+  // Precedes every object. Blocks are powers of two of at least 64
+  // bytes, so objects are 16-byte aligned.
+  struct Block {
+    std::uint64_t next, prev; // the list of allocated blocks, or a free list
+    std::uint32_t type;       // hash of typeid(T).name()
+    std::uint32_t refCount;   // PersistentPointers in the heap
+    std::uint32_t pins;       // other PersistentPointers, if epoch is current
+    std::uint32_t epoch;
+    std::uint32_t count;      // elements
+    std::uint8_t sizeClass;   // log2 of the block size
+    std::uint8_t flags;
+    std::uint64_t dying;      // next block to destroy, while DYING
+  };
+  static const std::size_t BLOCK = 48; // sizeof(Block), rounded up to 16
+  static_assert(sizeof(Block) <= BLOCK, "Block does not fit its header");
+  struct Root {
+    char name[ROOT_NAME];
+    std::uint64_t offset;
+  };
+  struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t epoch;
+    std::uint64_t capacity;
+    std::uint64_t top;    // start of the space never allocated
+    std::uint64_t blocks; // first allocated block
+    std::uint64_t live;
+    std::uint64_t liveBytes;
+    std::uint32_t clean;
+    std::uint32_t unused;
+    std::uint64_t free[64]; // one list per size class
+    Root roots[GC_PERSISTENT_ROOTS];
+  };
+  struct Type {
+    std::uint32_t id;
+    void (*destroy)(void *, std::uint32_t);
+  };
+  // Process-local state; trivially destructible.
+  struct State {
+    unsigned char *base;
+    std::size_t size;
+    int fd;
+    bool wasClean;
+    bool collecting;
+    bool destroying;
+    std::uint64_t dying; // blocks waiting for destroy()
+    std::uint32_t types;
+    Type type[GC_PERSISTENT_TYPES];
+  };
+
+  static const char *magic() { return "GCHEAP1"; } // 8 bytes with the NUL
+  static std::size_t first() { return (sizeof(Header) + 63) & ~(std::size_t)63; }
+  static State &state() {
+    static State s;
+    return s;
+  }
+  static Header &header() { return *reinterpret_cast<Header *>(state().base); }
+  static Block &block(std::uint64_t offset) {
+    return *reinterpret_cast<Block *>(state().base + offset);
+  }
+  static void *object(std::uint64_t offset) { return state().base + offset; }
+  // Whether a PersistentPointer at p is stored in the heap.
+  static bool stored(const void *p) {
+    const unsigned char *c = static_cast<const unsigned char *>(p);
+    return c >= state().base && c < state().base + state().size;
+  }
+  static bool unreferenced(const Block &b) {
+    return b.refCount == 0 && (b.epoch != header().epoch || b.pins == 0);
+  }
+
+  // A stable id for T, registering how to destroy it on first use.
+  // Called with the collector lock held, which also keeps two threads
+  // from waiting on each other in the initialization of id.
+  template <class T> static std::uint32_t typeId() {
+    static const std::uint32_t id = addType(typeid(T).name(), destroyObjects<T>);
+    return id;
+  }
+  template <class T> static void destroyObjects(void *p, std::uint32_t count) {
+    T *t = static_cast<T *>(p);
+    while (count > 0)
+      t[--count].~T();
+  }
+  static std::uint32_t addType(const char *name, void (*destroy)(void *, std::uint32_t)) {
+    // FNV-1a, so that the id is the same in every run.
+    std::uint32_t id = 2166136261u;
+    for (; *name; name++)
+      id = (id ^ (unsigned char)*name) * 16777619u;
+    State &s = state();
+    if (!findType(id) && s.types < GC_PERSISTENT_TYPES) {
+      s.type[s.types].id = id;
+      s.type[s.types].destroy = destroy;
+      s.types++;
+    }
+    return id;
+  }
+  static Type *findType(std::uint32_t id) {
+    State &s = state();
+    for (std::uint32_t i = 0; i < s.types; i++)
+      if (s.type[i].id == id)
+        return &s.type[i];
+    return nullptr;
+  }
+  static Root *findRoot(const char *name, bool add) {
+    Header &h = header();
+    Root *empty = nullptr;
+    for (unsigned i = 0; i < GC_PERSISTENT_ROOTS; i++) {
+      if (!h.roots[i].offset) {
+        if (!empty)
+          empty = &h.roots[i];
+      }
+      else if (std::strncmp(h.roots[i].name, name, ROOT_NAME - 1) == 0)
+        return &h.roots[i];
+    }
+    return add ? empty : nullptr;
+  }
+
+  // Returns the offset of a new block's object, allocated but not
+  // constructed. Throws std::bad_alloc when the heap is full.
+  static std::uint64_t allocate(std::size_t bytes, std::uint32_t type,
+                                std::uint32_t count) {
+    if (!state().base)
+      throw std::bad_alloc();
+    Header &h = header();
+    unsigned c = 6;
+    while (c < 63 && ((std::uint64_t)1 << c) < BLOCK + bytes)
+      c++;
+    std::uint64_t size = (std::uint64_t)1 << c;
+    std::uint64_t offset = h.free[c];
+    if (offset) {
+      h.free[c] = block(offset).next;
+    }
+    else {
+      if (BLOCK + bytes > size || size > h.capacity - h.top)
+        throw std::bad_alloc();
+      offset = h.top;
+      h.top += size;
+    }
+    Block &b = block(offset);
+    b.next = h.blocks;
+    b.prev = 0;
+    b.type = type;
+    b.refCount = 0;
+    b.pins = 0;
+    b.epoch = h.epoch;
+    b.count = count;
+    b.sizeClass = (std::uint8_t)c;
+    b.flags = ALLOCATED;
+    if (h.blocks)
+      block(h.blocks).prev = offset;
+    h.blocks = offset;
+    h.live++;
+    h.liveBytes += size;
+    return offset + BLOCK;
+  }
+  static void deallocate(std::uint64_t offset) {
+    Header &h = header();
+    Block &b = block(offset);
+    if (b.prev)
+      block(b.prev).next = b.next;
+    else
+      h.blocks = b.next;
+    if (b.next)
+      block(b.next).prev = b.prev;
+    b.flags = 0;
+    b.next = h.free[b.sizeClass];
+    h.free[b.sizeClass] = offset;
+    h.live--;
+    h.liveBytes -= (std::uint64_t)1 << b.sizeClass;
+  }
+  // A PersistentPointer to the object at offset.
+  template <class T> static PersistentPointer<T> adopt(std::uint64_t offset) {
+    return PersistentPointer<T>(offset);
+  }
+  // Runs the destructors of the block at offset and frees it. The
+  // blocks those destructors release are queued and destroyed here too,
+  // so a long chain of objects is freed without recursion.
+  static void destroy(std::uint64_t offset) {
+    State &s = state();
+    Block &b = block(offset);
+    b.flags |= DYING;
+    b.dying = s.dying;
+    s.dying = offset;
+    if (s.destroying)
+      return;
+    s.destroying = true;
+    while (s.dying) {
+      std::uint64_t next = s.dying;
+      Block &k = block(next);
+      s.dying = k.dying;
+      findType(k.type)->destroy(object(next + BLOCK), k.count);
+      deallocate(next);
+    }
+    s.destroying = false;
+  }
+
+  // Count one more reference to the object at offset, from a
+  // PersistentPointer stored in the heap or elsewhere.
+  static void retain(std::uint64_t offset, bool inHeap) {
+    Block &b = block(offset - BLOCK);
+    if (inHeap) {
+      b.refCount++;
+      return;
+    }
+    if (b.epoch != header().epoch) {
+      b.epoch = header().epoch;
+      b.pins = 0;
+    }
+    b.pins++;
+  }
+  // Drop a reference, destroying the object if it was the last one.
+  static void release(std::uint64_t offset, bool inHeap) {
+    Block &b = block(offset - BLOCK);
+    if (inHeap)
+      b.refCount--;
+    else
+      b.pins--;
+    if (unreferenced(b) && !(b.flags & DYING) && findType(b.type))
+      destroy(offset - BLOCK);
+  }
+};
+
+/*
+    PersistentPointer refers to an object in the
+    persistent heap by its offset, and counts as a
+    reference to it (see GCPersistentHeap).
+*/
+template <class T> class PersistentPointer {
+  std::uint64_t off; // offset of the object in the heap, 0 if null
+  friend class GCPersistentHeap;
+  // Counts one more reference to the object at o.
+  explicit PersistentPointer(std::uint64_t o) : off(o) {
+    GCPersistentHeap::retain(off, GCPersistentHeap::stored(this));
+  }
+public:
+  PersistentPointer() : off(0) {}
+  PersistentPointer(std::nullptr_t) : off(0) {}
+  PersistentPointer(const PersistentPointer &p) : off(p.off) {
+    GC_LOCK();
+    if (off)
+      GCPersistentHeap::retain(off, GCPersistentHeap::stored(this));
+  }
+  ~PersistentPointer() {
+    GC_LOCK();
+    if (off) {
+      GCPersistentHeap::typeId<T>();
+      GCPersistentHeap::release(off, GCPersistentHeap::stored(this));
+    }
+  }
+  PersistentPointer &operator=(const PersistentPointer &p) {
+    GC_LOCK();
+    // Count the new reference first: dropping the old one may destroy
+    // the object holding p.
+    std::uint64_t old = off;
+    off = p.off;
+    if (off)
+      GCPersistentHeap::retain(off, GCPersistentHeap::stored(this));
+    if (old) {
+      GCPersistentHeap::typeId<T>();
+      GCPersistentHeap::release(old, GCPersistentHeap::stored(this));
+    }
+    return *this;
+  }
+  PersistentPointer &operator=(std::nullptr_t) {
+    return *this = PersistentPointer();
+  }
+  // Valid until the heap is closed.
+  T *get() const {
+    return off ? static_cast<T *>(GCPersistentHeap::object(off)) : nullptr;
+  }
+  T &operator*() const { return *get(); }
+  T *operator->() const { return get(); }
+  T &operator[](std::size_t i) const { return get()[i]; }
+  operator T *() const { return get(); }
+  // The position of the object in the heap file.
+  std::uint64_t offset() const { return off; }
+};
+
+// Allocate a T constructed from args in the persistent heap.
+template <class T, class... Args>
+PersistentPointer<T> make_persistent(Args &&... args) {
+  static_assert(!std::is_polymorphic<T>::value,
+                "vtable pointers do not survive a restart");
+  static_assert(alignof(T) <= 16, "persistent objects are 16-byte aligned");
+  GC_LOCK();
+  std::uint32_t type = GCPersistentHeap::typeId<T>();
+  std::uint64_t offset = GCPersistentHeap::allocate(sizeof(T), type, 1);
+  try {
+    new (GCPersistentHeap::object(offset)) T(std::forward<Args>(args)...);
+  } catch (...) {
+    GCPersistentHeap::deallocate(offset - GCPersistentHeap::BLOCK);
+    throw;
+  }
+  return GCPersistentHeap::adopt<T>(offset);
+}
+
+// Allocate a value-initialized array of length elements in the
+// persistent heap.
+template <class T>
+PersistentPointer<T> make_persistent_array(std::uint32_t length) {
+  static_assert(!std::is_polymorphic<T>::value,
+                "vtable pointers do not survive a restart");
+  static_assert(alignof(T) <= 16, "persistent objects are 16-byte aligned");
+  GC_LOCK();
+  std::uint32_t type = GCPersistentHeap::typeId<T>();
+  std::uint64_t offset =
+      GCPersistentHeap::allocate(sizeof(T) * (std::size_t)length, type, length);
+  T *t = static_cast<T *>(GCPersistentHeap::object(offset));
+  std::uint32_t i = 0;
+  try {
+    for (; i < length; i++)
+      new (t + i) T();
+  } catch (...) {
+    while (i > 0)
+      t[--i].~T();
+    GCPersistentHeap::deallocate(offset - GCPersistentHeap::BLOCK);
+    throw;
+  }
+  return GCPersistentHeap::adopt<T>(offset);
+}
+#endif
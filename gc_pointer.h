@@ -1,21 +1,66 @@
+#include "gc_compact.h"
 #include "gc_details.h"
 #include "gc_iterator.h"
+#include "gc_large.h"
+#include "gc_lock.h"
+#include "gc_perf.h"
+#include "gc_quarantine.h"
+#include "gc_snapshot.h"
+#include "gc_span.h"
+#include "gc_trace.h"
+#include <cassert>
 #include <cstdlib>
 #include <iostream>
+#include <iterator>
 #include <list>
+#include <memory>
+#include <type_traits>
 #include <typeinfo>
+#include <utility>
+
+// Uses GC_LOCK().
+#include "gc_persistent.h"
+#include "gc_scavenge.h"
+
 /*
     Pointer implements a pointer type that uses
     garbage collection to release unused memory.
     A Pointer must only be used to point to memory
     that was dynamically allocated using new.
     When used to refer to an allocated array,
-    specify the array size.
+    specify the array size, either at run time
+    (Pointer<T>(new T[n], n), make_gc_array<T>(n))
+    or as the template argument (Pointer<T, n>).
+    A Pointer<Derived> converts to a Pointer<Base>,
+    and a Pointer to a member of a managed object can
+    be made with the aliasing constructor; both share
+    the count of the owning allocation.
+    Memory that must not go back through delete (pools,
+    mmap'd regions, C libraries) can be given a deleter,
+    or allocated with allocate_gc() from an allocator.
 */
-template <class T, int size = 0> class Pointer {
+template <class T, int size = 0> class Pointer;
+
+// Pointer<T> holds the whole implementation. The length of
+// an array lives in its PtrDetails, so arrays of every
+// length share one refContainer and one code path;
+// Pointer<T, size> below only supplies a default length.
+template <class T> class Pointer<T, 0> {
 private:
   // refContainer maintains the garbage collection list.
   static std::list<PtrDetails<T>> refContainer;
+  // The entries of arrays from the large-object space (see
+  // gc_large.h), kept apart so that they can be collected
+  // without sweeping refContainer.
+  static std::list<PtrDetails<T>> largeContainer;
+  // details is the refContainer entry of the memory this
+  // Pointer points to, or null for a null Pointer. List
+  // entries never move, so no lookup is needed to update
+  // the reference count. The entry may belong to another
+  // Pointer type's refContainer (see the converting and
+  // aliasing constructors). Heap snapshots find Pointers
+  // inside managed blocks by details (see WeakPointer).
+  PtrDetailsBase *details;
   // addr points to the allocated memory to which
   // this Pointer pointer currently points.
   T *addr;
@@ -29,38 +74,124 @@ private:
   // array, then arraySize contains its size.
   unsigned arraySize; // size of the array
   static bool first;  // true when first Pointer is created
-  // Return an iterator to pointer details in refContainer.
-  typename std::list<PtrDetails<T>>::iterator findPtrInfo(T *ptr);
+  static bool collecting; // true while collect() is running
+  // Sets collecting for as long as it lives, so that a throwing
+  // destructor or deleter does not leave it set.
+  struct Collecting {
+    Collecting() { collecting = true; }
+    ~Collecting() { collecting = false; }
+  };
+  // Return the entry tracking ptr, or null.
+  static PtrDetails<T> *findPtrInfo(T *ptr);
+  // Return the entry for t, adding one if t is not tracked
+  // yet, and count one more reference to it. created (if
+  // given) tells whether the entry is new.
+  static PtrDetails<T> *acquire(T *t, unsigned length,
+                                bool *created = nullptr);
+  // Point at t, within the memory tracked by d, and count one
+  // more reference to d. A length greater than zero means t
+  // is an array of that many elements.
+  Pointer(PtrDetailsBase *d, T *t, unsigned length);
+  // The address to use. Relocatable types are read through
+  // details, since compact() may have moved them; with
+  // GC_THREAD_SAFE, only under a GCRelocationGuard.
+  T *get() const {
+    if (GCRelocatable<T>::value && details) {
+      assert(GCRelocationGuard::held() &&
+             "dereferencing a relocatable Pointer without a GCRelocationGuard");
+      return static_cast<PtrDetails<T> *>(details)->memPtr;
+    }
+    return addr;
+  }
+  // Count one reference less to d. Memory converted from
+  // another Pointer type is freed by that type as soon as
+  // the last reference goes.
+  static void letGo(PtrDetailsBase *d);
+  // Move the unreferenced entries of from to garbage.
+  static void sweep(std::list<PtrDetails<T>> &from,
+                    std::list<PtrDetails<T>> &garbage);
+  // Put the entries of garbage back where they came from, but
+  // for those of freed memory that no WeakPointer holds.
+  static void restore(std::list<PtrDetails<T>> &garbage);
+  // collect(), or collectLarge() if small is false.
+  static bool reclaim(bool small);
+  // Whether compact() can move the block of entry p.
+  static bool movable(const PtrDetails<T> &p);
+  // Append the blocks in refContainer to a heap snapshot.
+  static void snapshot(std::uint32_t type, std::vector<GCSnapshotBlock> &out);
+  template <class U, int N> friend class Pointer;
+  template <class U> friend class WeakPointer;
 
 public:
   // Define an iterator type for Pointer<T>.
   typedef Iter<T> GCiterator;
-  // Empty constructor
-  // NOTE: templates aren't able to have prototypes with default arguments
-  // this is why constructor is designed like this:
-  Pointer() { Pointer(NULL); }
-  Pointer(T *);
+  // Empty constructor.
+  Pointer() : Pointer(static_cast<T *>(nullptr)) {}
+  // Track t; a length greater than zero means t points
+  // to an array of that many elements allocated by new[].
+  Pointer(T *t, unsigned length = 0);
+  // Track t and free it with d(t) when it becomes garbage.
+  // If t is already tracked, it keeps its first deleter. d
+  // is copied, so that it can still free t if tracking fails.
+  template <class D, class = typename std::enable_if<
+                         std::is_invocable<D &, T *>::value>::type>
+  Pointer(T *t, D d) : Pointer(t, 0, std::move(d)) {}
+  template <class D, class = typename std::enable_if<
+                         std::is_invocable<D &, T *>::value>::type>
+  Pointer(T *t, unsigned length, D d);
   // Copy constructor.
   Pointer(const Pointer &);
+  // Convert from a Pointer to a type whose pointers convert to
+  // T *, such as a derived class. The array length is kept only
+  // when the element type stays the same.
+  template <class U, class = typename std::enable_if<
+                         std::is_convertible<U *, T *>::value>::type>
+  Pointer(const Pointer<U> &ob)
+      : Pointer(ob.details, ob.addr, sameElement<U>() ? ob.arraySize : 0) {
+    static_assert(!GCRelocatable<T>::value && !GCRelocatable<U>::value,
+                  "Pointers to relocatable types cannot be converted");
+  }
+  // Aliasing constructor: point at t, usually a member of the
+  // object owner points to, keeping that object alive.
+  template <class U>
+  Pointer(const Pointer<U> &owner, T *t) : Pointer(owner.details, t, 0) {
+    static_assert(!GCRelocatable<T>::value && !GCRelocatable<U>::value,
+                  "Pointers to relocatable types cannot be aliased");
+  }
   // Destructor for Pointer.
   ~Pointer();
   // Collect garbage. Returns true if at least
   // one object was freed.
-  static bool collect();
+  static bool collect() { return reclaim(true); }
+  // Collect only the large arrays, without sweeping the
+  // small blocks.
+  static bool collectLarge() { return reclaim(false); }
+  // Move the live blocks of a relocatable T into one new
+  // region (see gc_compact.h). Returns the number moved. With
+  // GC_THREAD_SAFE, waits for other threads' GCRelocationGuards,
+  // and moves nothing if this thread holds one.
+  static std::size_t compact();
   // Overload assignment of pointer to Pointer.
-  T *operator=(T *t);
+  T *operator=(T *t) { return assign(t, 0); }
   // Overload assignment of Pointer to Pointer.
   Pointer &operator=(Pointer &rv);
+  // Assignment from a Pointer to a convertible type.
+  template <class U, class = typename std::enable_if<
+                         std::is_convertible<U *, T *>::value>::type>
+  Pointer &operator=(const Pointer<U> &rv) {
+    Pointer tmp(rv);
+    return *this = tmp;
+  }
   // Return a reference to the object pointed
   // to by this Pointer.
-  T &operator*() { return *addr; }
+  T &operator*() { return *get(); }
   // Return the address being pointed to.
-  T *operator->() { return addr; }
+  T *operator->() { return get(); }
   // Return a reference to the object at the
   // index specified by i.
-  T &operator[](int i) { return addr[i]; }
+  T &operator[](int i) { return get()[i]; }
   // Conversion function to T *.
-  operator T *() { return addr; }
+  operator T *() { return get(); }
   // Return an Iter to the start of the allocated memory.
 
   Iter<T> begin() {
@@ -69,7 +200,8 @@ public:
       _size = arraySize;
     else
       _size = 1;
-    return Iter<T>(addr, addr, addr + _size);
+    T *t = get();
+    return Iter<T>(t, t, t + _size);
   }
 
   // Return an Iter to one past the end of an allocated array.
@@ -79,84 +211,386 @@ public:
       _size = arraySize;
     else
       _size = 1;
-    return Iter<T>(addr + _size, addr, addr + _size);
+    T *t = get();
+    return Iter<T>(t + _size, t, t + _size);
+  }
+  // Return a view of the allocated memory that carries its
+  // length but, like an Iter, does not keep it alive.
+  Span<T> span() {
+    return Span<T>(get(), isArray ? arraySize : 1);
+  }
+  // Return a rows x cols row-major view of an allocated array.
+  // Do not allow views larger than the array.
+  Span2D<T> span2d(unsigned rows, unsigned cols) {
+    if ((std::size_t)rows * cols > (isArray ? arraySize : 1))
+      throw OutOfRangeExc();
+    return Span2D<T>(get(), rows, cols);
   }
   // Return the size of refContainer for this type of Pointer.
-  static int refContainerSize() { return refContainer.size(); }
+  static int refContainerSize() {
+    GC_LOCK();
+    return refContainer.size() + largeContainer.size();
+  }
   // A utility function that displays refContainer.
   static void showlist();
   // Clear refContainer when program exits.
   static void shutdown();
+
+protected:
+  // Point at t, an array of length elements if length > 0.
+  T *assign(T *t, unsigned length);
+
+private:
+  // True if a U array can be walked as a T array.
+  template <class U> static constexpr bool sameElement() {
+    return std::is_same<typename std::remove_cv<U>::type,
+                        typename std::remove_cv<T>::type>::value;
+  }
+};
+
+// A Pointer whose raw pointer constructor and assignment
+// take the pointee to be an array of size elements.
+template <class T, int size> class Pointer : public Pointer<T> {
+public:
+  Pointer() {}
+  Pointer(T *t) : Pointer<T>(t, size) {}
+  template <class D, class = typename std::enable_if<
+                         std::is_invocable<D &, T *>::value>::type>
+  Pointer(T *t, D d) : Pointer<T>(t, size, std::move(d)) {}
+  Pointer(const Pointer &ob) : Pointer<T>(ob) {}
+  // From make_gc_array<T>(size), which maps large arrays
+  // on their own where new T[size] would not. Throws
+  // OutOfRangeExc if ob is not null and not size long.
+  Pointer(const Pointer<T> &ob) : Pointer<T>(sized(ob)) {}
+  T *operator=(T *t) { return this->assign(t, size); }
+  Pointer &operator=(Pointer &rv) {
+    Pointer<T>::operator=(rv);
+    return *this;
+  }
+
+private:
+  static const Pointer<T> &sized(const Pointer<T> &ob) {
+    if (ob.details && ob.arraySize != (unsigned)size)
+      throw OutOfRangeExc();
+    return ob;
+  }
+};
+
+// Allocate a T constructed from args and return a Pointer to it.
+template <class T, class... Args> Pointer<T> make_gc(Args &&... args) {
+  return Pointer<T>(new T(std::forward<Args>(args)...));
+}
+
+// Allocate a value-initialized array of length elements and
+// return a Pointer that knows its length. Large arrays are
+// mapped on their own (see gc_large.h).
+template <class T> Pointer<T> make_gc_array(unsigned length) {
+  std::size_t bytes = sizeof(T) * (std::size_t)length;
+  if (GCLargeObjects::wanted(bytes, alignof(T))) {
+    T *t;
+    {
+      GC_LOCK();
+      t = static_cast<T *>(GCLargeObjects::allocate(bytes));
+    }
+    if (t) {
+      unsigned i = 0;
+      try {
+        for (; i < length; i++)
+          ::new ((void *)(t + i)) T();
+      } catch (...) {
+        GCLargeDeleter<T> undo = {i};
+        GC_LOCK();
+        undo(t);
+        throw;
+      }
+      return Pointer<T>(t, length, GCLargeDeleter<T>{length});
+    }
+  }
+  return Pointer<T>(new T[length](), length);
+}
+
+// Deleter for memory from allocate_gc(): destroys the count
+// elements and gives them back to the allocator. A stateless
+// allocator takes no space (it is an empty base).
+template <class Alloc> class GCAllocDeleter : private Alloc {
+  typedef std::allocator_traits<Alloc> Traits;
+  std::size_t count;
+public:
+  GCAllocDeleter(const Alloc &alloc, std::size_t n) : Alloc(alloc), count(n) {}
+  void operator()(typename Traits::value_type *p) {
+    Alloc &alloc = *this;
+    for (std::size_t i = count; i > 0; i--)
+      Traits::destroy(alloc, p + i - 1);
+    Traits::deallocate(alloc, p, count);
+  }
+};
+
+// Allocate a T constructed from args with alloc and return a
+// Pointer that gives it back to alloc when it becomes garbage.
+template <class T, class Alloc, class... Args>
+Pointer<T> allocate_gc(const Alloc &alloc, Args &&... args) {
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<T> A;
+  typedef std::allocator_traits<A> Traits;
+  A a(alloc);
+  T *t = Traits::allocate(a, 1);
+  try {
+    Traits::construct(a, t, std::forward<Args>(args)...);
+  } catch (...) {
+    Traits::deallocate(a, t, 1);
+    throw;
+  }
+  return Pointer<T>(t, GCAllocDeleter<A>(a, 1));
+}
+
+// Allocate a value-initialized array of length elements with
+// alloc, as make_gc_array() does with new[].
+template <class T, class Alloc>
+Pointer<T> allocate_gc_array(const Alloc &alloc, unsigned length) {
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<T> A;
+  typedef std::allocator_traits<A> Traits;
+  A a(alloc);
+  T *t = Traits::allocate(a, length);
+  unsigned i = 0;
+  try {
+    for (; i < length; i++)
+      Traits::construct(a, t + i);
+  } catch (...) {
+    while (i > 0)
+      Traits::destroy(a, t + --i);
+    Traits::deallocate(a, t, length);
+    throw;
+  }
+  return Pointer<T>(t, length, GCAllocDeleter<A>(a, length));
+}
+
+// Write a snapshot of every block managed by any Pointer type to path
+// (see gc_snapshot.h). Returns false if the file cannot be written.
+inline bool write_gc_snapshot(const char *path) {
+  GC_LOCK();
+  std::FILE *out = std::fopen(path, "wb");
+  if (!out)
+    return false;
+  bool ok = GCSnapshot::write(out);
+  return std::fclose(out) == 0 && ok;
+}
+
+/*
+    WeakPointer refers to memory managed by Pointer
+    without keeping it alive: collect() frees the
+    memory once no Pointer refers to it, but keeps the
+    PtrDetails entry while WeakPointers still do, so
+    they can tell the memory is gone.
+*/
+template <class T> class WeakPointer {
+  // The entry, or 0 if empty, with GCSnapshot::WEAK set so that
+  // heap snapshots can tell weak references from strong ones.
+  std::uintptr_t details;
+  T *addr;
+  unsigned arraySize;
+  template <class U> friend class WeakPointer;
+  PtrDetailsBase *entry() const {
+    return reinterpret_cast<PtrDetailsBase *>(details & ~GCSnapshot::WEAK);
+  }
+  static std::uintptr_t tag(PtrDetailsBase *d) {
+    return d ? reinterpret_cast<std::uintptr_t>(d) | GCSnapshot::WEAK : 0;
+  }
+public:
+  WeakPointer() : details(0), addr(nullptr), arraySize(0) {}
+  template <class U, class = typename std::enable_if<
+                         std::is_convertible<U *, T *>::value>::type>
+  WeakPointer(const Pointer<U> &p)
+      : details(tag(p.details)), addr(p.addr), arraySize(0) {
+    GC_LOCK();
+    if (details)
+      entry()->upWeakCount();
+  }
+  WeakPointer(const Pointer<T> &p)
+      : details(tag(p.details)), addr(p.addr), arraySize(p.arraySize) {
+    GC_LOCK();
+    if (details)
+      entry()->upWeakCount();
+  }
+  WeakPointer(const WeakPointer &ob)
+      : details(ob.details), addr(ob.addr), arraySize(ob.arraySize) {
+    GC_LOCK();
+    if (details)
+      entry()->upWeakCount();
+  }
+  template <class U, class = typename std::enable_if<
+                         std::is_convertible<U *, T *>::value>::type>
+  WeakPointer(const WeakPointer<U> &ob)
+      : details(ob.details), addr(ob.addr), arraySize(0) {
+    GC_LOCK();
+    if (details)
+      entry()->upWeakCount();
+  }
+  ~WeakPointer() {
+    GC_LOCK();
+    if (details)
+      entry()->downWeakCount();
+  }
+  WeakPointer &operator=(const WeakPointer &rv) {
+    WeakPointer tmp(rv);
+    std::swap(details, tmp.details);
+    std::swap(addr, tmp.addr);
+    std::swap(arraySize, tmp.arraySize);
+    return *this;
+  }
+  WeakPointer &operator=(const Pointer<T> &rv) { return *this = WeakPointer(rv); }
+  // True if the memory has been collected (or there never was any).
+  bool expired() const {
+    GC_LOCK();
+    return !details || entry()->expired;
+  }
+  // Return a Pointer to the memory, or a null Pointer if it is gone.
+  Pointer<T> lock() const {
+    GC_LOCK();
+    if (expired())
+      return Pointer<T>();
+    return Pointer<T>(entry(), addr, arraySize);
+  }
 };
 
 // STATIC MEMBER INITIALIZATION.
 // Creates storage for the static variables
 // Initializes both refContainer (list of PtrDetails objects) and
 // first (indicates whether it is the first pointer to be collected).
-template <class T, int size>
-std::list<PtrDetails<T>> Pointer<T, size>::refContainer;
+template <class T>
+std::list<PtrDetails<T>> Pointer<T>::refContainer;
+template <class T>
+std::list<PtrDetails<T>> Pointer<T>::largeContainer;
 // By default first is true, meaning that at the very beginning of the
 // instantiation, there is no memory block being pointed at.
-template <class T, int size>
-bool Pointer<T, size>::first = true;
+template <class T>
+bool Pointer<T>::first = true;
+
+template <class T>
+bool Pointer<T>::collecting = false;
 
 // INSTANCES MEMBER INITIALIZATION.
 
 ////////////////////////////////////////////////////////////////////////////
 //                         POINTER CONSTRUCTOR                            //
 ////////////////////////////////////////////////////////////////////////////
-template <class T, int size>
-Pointer<T, size>::Pointer(T * t) {
+template <class T>
+Pointer<T>::Pointer(T * t, unsigned length) {
+  GC_LOCK();
+  GC_PERF_SAMPLED_SCOPE(CONSTRUCT);
   // Register shutdown() as an exit function.
   if (first) {
     // This function lets calling "shutdown" function when execution thread
     // returns from main(). Just set when at least one object has been referenced
     // for garbage collection.
     atexit(shutdown);
+    // List refContainer in heap snapshots.
+    GCSnapshot::registerType(typeid(T).name(), &snapshot);
   }
   // Reset first static member.
   first = false;
+  // Find or create the PtrDetails item for t and count this reference.
+  details = acquire(t, length);
+  // In any case, the values have to be stored within this pointer object.
+  // The array length is the one recorded with the memory block.
+  addr = t;
+  isArray = details ? details->isArray : false;
+  arraySize = details ? details->arraySize : 0;
+}
+
+template <class T>
+Pointer<T>::Pointer(PtrDetailsBase *d, T *t, unsigned length) {
+  GC_LOCK();
+  // Share the entry of the Pointer (or WeakPointer) we come from.
+  details = d;
+  if (details)
+    details->upRefCount();
+  addr = t;
+  isArray = length > 0;
+  arraySize = length;
+}
+
+template <class T>
+template <class D, class>
+Pointer<T>::Pointer(T *t, unsigned length, D d) {
+  GC_LOCK();
+  GC_PERF_SAMPLED_SCOPE(CONSTRUCT);
+  if (first) {
+    atexit(shutdown);
+    GCSnapshot::registerType(typeid(T).name(), &snapshot);
+  }
+  first = false;
+  // The deleter is stored before t is tracked, so that a failure
+  // leaves no entry that would free t with delete.
+  typename PtrDetails<T>::Deleter stored = typename PtrDetails<T>::Deleter();
+  bool created = false;
+  PtrDetails<T> *p;
+  try {
+    // A copy, so that d is still whole for the fallback below.
+    stored = PtrDetails<T>::makeDeleter(d);
+    p = acquire(t, length, &created);
+  } catch (...) {
+    // Like shared_ptr, free t if it could not be tracked.
+    PtrDetails<T>::discardDeleter(stored);
+    if (t && !findPtrInfo(t))
+      d(t);
+    throw;
+  }
+  // Memory that is already tracked keeps the deleter it came with.
+  if (created)
+    p->adoptDeleter(stored);
+  else
+    PtrDetails<T>::discardDeleter(stored);
+  details = p;
+  addr = t;
+  isArray = p ? p->isArray : false;
+  arraySize = p ? p->arraySize : 0;
+}
+
+template <class T>
+PtrDetails<T> *Pointer<T>::acquire(T *t, unsigned length, bool *created) {
+  // Null Pointers are not tracked.
+  if (!t)
+    return nullptr;
   // First we should know if the address pointed at by the given pointer (t),
   // is already pointed at by other pointer(s) in the list of PtrDetails items.
   // To do that, we need to create an iterator to the list of PtrDetails items.
-  typename std::list<PtrDetails<T>>::iterator p;
   // We call the function findPtrInfo which tells us if there is a pointer
   // that is pointing at to the given address (t).
-  p = findPtrInfo(t);
-  // We check if the iterator is pointing at any item.
-  if (p != refContainer.end()) {
+  PtrDetails<T> *p = findPtrInfo(t);
+  // We check if the pointer is pointing at any item.
+  if (p) {
     // In case it exists a PtrDetails object, we update it's counter.
     p->upRefCount();
   }
   else {
     // In case is a pointer to a new allocated item in the heap.
     // Include that item in the container for references.
-    refContainer.emplace_back(t, size);
+    bool large = GCLargeObjects::contains(t);
+    std::list<PtrDetails<T>> &list = large ? largeContainer : refContainer;
+    list.emplace_back(t, length);
+    p = &list.back();
+    p->large = large;
+    // Pointers of other types sharing this entry collect through here.
+    p->collectOwner = &collect;
+    if (created)
+      *created = true;
   }
-  // But in any case, the values have to be stored within this pointer object.
-  addr = t;
-  // Store whether it is an array or not (size is greater than 0)
-  if (size > 0) {
-    isArray = true;
-  }
-  else {
-    isArray = false;
-  }
-  arraySize = size;
+  return p;
 }
 
 ////////////////////////////////////////////////////////////////////////////
 //                       POINTER COPY CONSTRUCTOR                         //
 ////////////////////////////////////////////////////////////////////////////
 
-template <class T, int size>
-Pointer<T, size>::Pointer(const Pointer &ob) {
-    typename std::list<PtrDetails<T>>::iterator p;
+template <class T>
+Pointer<T>::Pointer(const Pointer &ob) {
+    GC_LOCK();
+    GC_PERF_SAMPLED_SCOPE(COPY);
     // A copy constructor copies the given object content to a new object,
-    // so a PtrDetails object must exist.
-    p = findPtrInfo(ob.addr);
+    // so the PtrDetails object (if any) is the one ob refers to.
+    details = ob.details;
     // First, update the reference count for that memory block.
-    p->upRefCount();
+    if (details)
+      details->upRefCount();
     // Then we copy all the member instance info.
     addr = ob.addr;
     isArray = ob.isArray;
@@ -166,52 +600,57 @@ Pointer<T, size>::Pointer(const Pointer &ob) {
 ////////////////////////////////////////////////////////////////////////////
 //                       POINTER DESTRUCTOR                              //
 ////////////////////////////////////////////////////////////////////////////
-template <class T, int size>
-Pointer<T, size>::~Pointer() {
-  typename std::list<PtrDetails<T> >::iterator p;
-  // A PtrDetails item should be found at the reference container.
-  p = findPtrInfo(addr);
+template <class T>
+Pointer<T>::~Pointer() {
+  GC_LOCK();
+  GC_PERF_SAMPLED_SCOPE(DESTROY);
+  // The entry may be erased once the count is down, so remember
+  // which refContainer it is in first.
+  bool (*owner)() = details ? details->collectOwner : nullptr;
   // We decrease the reference count for this address PtrDetails.
-  p->downRefCount();
+  if (details)
+    details->downRefCount();
   // Collect garbage when a pointer goes at of scope.
+#ifndef GC_QUIET
   std::cout << "Before collecting garbage\n";
   showlist();
+#endif
 
   collect();
+  // Memory converted from another Pointer type is freed by
+  // that type.
+  if (owner && owner != &collect)
+    owner();
   // If a less frequent calls to garbage collection needed, 
   // revise this piece of code.
 
+#ifndef GC_QUIET
   std::cout << "After collecting garbage\n";
   showlist();
+#endif
 
 }
 
 ////////////////////////////////////////////////////////////////////////////
 //                          COLLECT GARBAGE                               //
 ////////////////////////////////////////////////////////////////////////////
-// Returns true if at least one object was freed.
-template <class T, int size>
-bool Pointer<T, size>::collect() {
-  bool memfreed = false;
-  typename std::list<PtrDetails<T> >::iterator p;
-  p = refContainer.begin();
-
-  while(p != refContainer.end()) {
-    // Scan refContainer looking for unreferenced pointers.
-    if (p->zeroRefCount()) {
+template <class T>
+void Pointer<T>::sweep(std::list<PtrDetails<T>> &from,
+                       std::list<PtrDetails<T>> &garbage) {
+  typename std::list<PtrDetails<T>>::iterator p = from.begin();
+  while(p != from.end()) {
+    // Scan the list looking for unreferenced pointers.
+    if (p->zeroRefCount() && p->memPtr) {
       // Means there are no references to this address, so we should
-      // delete the memory block.
-      // Free memory for that address that is no more pointed at.
-      if (p->isArray) {
-        delete[] p->memPtr;
-      }
-      else {
-        delete p->memPtr;
-      }
-      // Tell we have freed memory.
-      memfreed = true;
-      // Remove unused entry from refContainer.
-      p = refContainer.erase(p);
+      // delete the memory block. WeakPointers see it as gone from now
+      // on, even from the destructors run below.
+      p->expired = true;
+      garbage.splice(garbage.end(), from, p++);
+    }
+    else if (p->zeroRefCount() && p->zeroWeakCount()) {
+      // Remove unused entry from the list. Blocks whose memory is
+      // already gone are only kept for their WeakPointers.
+      p = from.erase(p);
     }
     else {
       // In case the item have not been erased, update the iterator
@@ -219,42 +658,198 @@ bool Pointer<T, size>::collect() {
       p++;
     }
   }
+}
+
+template <class T>
+void Pointer<T>::restore(std::list<PtrDetails<T>> &garbage) {
+  typename std::list<PtrDetails<T>>::iterator p;
+  for (p = garbage.begin(); p != garbage.end();) {
+    if (!p->memPtr && p->zeroWeakCount())
+      p = garbage.erase(p);
+    else if (p->large)
+      largeContainer.splice(largeContainer.end(), garbage, p++);
+    else
+      refContainer.splice(refContainer.end(), garbage, p++);
+  }
+}
+
+// Returns true if at least one object was freed.
+template <class T>
+bool Pointer<T>::reclaim(bool small) {
+  GC_LOCK();
+  // Freeing a block runs its destructor, whose Pointers call collect()
+  // again. Scanning the list from there would free the block being
+  // freed a second time and erase entries under our iterator, so
+  // nested calls return at once and we rescan until a pass frees
+  // nothing; blocks released by those destructors are found then.
+  if (collecting)
+    return false;
+  Collecting scope;
+  GC_TRACE_SCOPE("collect", typeid(T).name());
+  GC_PERF_SCOPE(COLLECT);
+  bool memfreed = false;
+  // Entries found unreferenced by a sweep are spliced (not copied) into
+  // garbage and their blocks freed together afterwards, so deleters run
+  // as one batch per sweep.
+  std::list<PtrDetails<T>> garbage;
+  typename std::list<PtrDetails<T> >::iterator p;
+  for (;;) {
+    {
+      GC_TRACE_SCOPE("sweep", typeid(T).name());
+      GC_PERF_SCOPE(SWEEP);
+      sweep(largeContainer, garbage);
+      if (small)
+        sweep(refContainer, garbage);
+    }
+    if (garbage.empty())
+      break;
+    // Tell we have freed memory.
+    memfreed = true;
+    GC_TRACE_SCOPE("finalize", typeid(T).name());
+    GC_PERF_SCOPE(FINALIZE);
+    try {
+      for (p = garbage.begin(); p != garbage.end(); p++) {
+        // Free memory for that address that is no more pointed at.
+        if (p->release) {
+          p->runDeleter();
+        }
+        else {
+#ifdef GC_QUARANTINE
+          // Debug builds park the poisoned block instead of freeing it.
+          GCQuarantine::retire(p->memPtr, p->isArray, p->arraySize);
+#else
+          if (p->isArray) {
+            delete[] p->memPtr;
+          }
+          else {
+            delete p->memPtr;
+          }
+#endif
+        }
+        p->memPtr = nullptr;
+      }
+    } catch (...) {
+      // The block that threw is taken as freed. The rest go back,
+      // to be freed by the next collection.
+      for (p = garbage.begin(); p != garbage.end() && !p->memPtr; p++)
+        ;
+      if (p != garbage.end()) {
+        p->memPtr = nullptr;
+        if (p->release)
+          p->runDeleter();
+      }
+      restore(garbage);
+      throw;
+    }
+    // Keep the entries WeakPointers still hold. The destructors may have
+    // dropped more references, so sweep again.
+    restore(garbage);
+  }
+  GC_TRACE_COUNTER("refContainer", typeid(T).name(), refContainer.size());
+  if (memfreed)
+    GCScavenger::notify();
   // Returns whether the memory has been freed or not.
   return memfreed;
 }
 
 ////////////////////////////////////////////////////////////////////////////
-//                   pointer TO POINTER ASSIGNMENT                        //
+//                             COMPACT                                    //
 ////////////////////////////////////////////////////////////////////////////
-template <class T, int size>
-T * Pointer<T, size>::operator=(T *t) {
-   // Check whether it is a PtrDetails object for this address in the 
-  // references container.
+template <class T>
+bool Pointer<T>::movable(const PtrDetails<T> &p) {
+  // Memory from new (not new[] with a cookie), or moved before.
+  return p.memPtr &&
+         (p.relocated ||
+          (!p.release &&
+           (!p.isArray || std::is_trivially_destructible<T>::value)));
+}
+
+template <class T>
+std::size_t Pointer<T>::compact() {
+  static_assert(GCRelocatable<T>::value,
+                "compact() needs GCRelocatable<T> (see gc_compact.h)");
+  static_assert(!std::is_polymorphic<T>::value &&
+                    std::is_move_constructible<T>::value,
+                "relocatable types are moved as T");
+#ifdef GC_THREAD_SAFE
+  // Waiting for our own guard would never end.
+  if (GCRelocationGuard::held())
+    return 0;
+  std::unique_lock<std::shared_mutex> moving = GCRelocationGuard::exclusive();
+#endif
+  GC_LOCK();
+  if (collecting)
+    return 0;
+  // Garbage would only be moved to be freed.
+  collect();
+  std::size_t bytes = 0, blocks = 0;
   typename std::list<PtrDetails<T>>::iterator p;
-  // The object that this pointer is pointing at may exist in the
-  // references container.
-  p = findPtrInfo(addr);
-  if (p != refContainer.end()) {
-    // In this case, the assignment of a new address forces the previous one
-    // lose it's pointer, so it's reference count should be decreased.
-    p->downRefCount();
+  for (p = refContainer.begin(); p != refContainer.end(); p++)
+    if (movable(*p)) {
+      bytes += sizeof(T) * (p->isArray ? p->arraySize : 1) + alignof(T) - 1;
+      blocks++;
+    }
+  if (blocks == 0)
+    return 0;
+  GCRegion *region = GCRegion::create(bytes);
+  if (!region)
+    return 0;
+  // The destructors of the moved-from objects must not start a
+  // collection of this type while the list is walked.
+  Collecting scope;
+  for (p = refContainer.begin(); p != refContainer.end(); p++) {
+    if (!movable(*p))
+      continue;
+    unsigned n = p->isArray ? p->arraySize : 1;
+    T *from = p->memPtr;
+    T *to = static_cast<T *>(region->take(sizeof(T) * n, alignof(T)));
+    for (unsigned i = 0; i < n; i++)
+      ::new ((void *)(to + i)) T(std::move(from[i]));
+    for (unsigned i = n; i > 0; i--)
+      from[i - 1].~T();
+    if (p->relocated) {
+      // Leave the old region; the last block out unmaps it.
+      GCRegion::owner(from)->drop(from, sizeof(T) * n);
+    }
+    else {
+      GCRegion::freeNew<T>(from, p->isArray);
+    }
+    p->memPtr = to;
+    p->relocated = true;
+    GCRegionDeleter<T> d = {n};
+    p->setDeleter(d);
   }
+  GCScavenger::notify();
+  return blocks;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//                   pointer TO POINTER ASSIGNMENT                        //
+////////////////////////////////////////////////////////////////////////////
+template <class T>
+void Pointer<T>::letGo(PtrDetailsBase *d) {
+  if (!d)
+    return;
+  d->downRefCount();
+  if (d->zeroRefCount() && d->collectOwner && d->collectOwner != &collect)
+    d->collectOwner();
+}
+
+template <class T>
+T * Pointer<T>::assign(T *t, unsigned length) {
+  GC_LOCK();
+  // The object that this pointer is pointing at is losing a pointer.
+  // It is let go of last, since freeing it may free t's owner.
+  PtrDetailsBase *old = details;
   // Now we need to check whether the new address to which is going
-  // to point at has been previously being appointed.
-  p = findPtrInfo(t);
-  if (p == refContainer.end()) {
-    // There is no such object, so we need to create a new one
-    // and emplace it back.
-    refContainer.emplace_back(t, size);
-  }
-  else {
-    // In case it exist, we should increment the counter for this reference.
-    p->upRefCount();
-  }
+  // to point at has been previously being appointed, and count the
+  // new reference.
+  details = acquire(t, length);
   // Update the Pointer with the given pointer.
   addr = t;
-  arraySize = size;
-  isArray = size > 0;
+  arraySize = details ? details->arraySize : 0;
+  isArray = details ? details->isArray : false;
+  letGo(old);
 
   // Assign the same pointer.
   return t;
@@ -263,70 +858,121 @@ T * Pointer<T, size>::operator=(T *t) {
 ////////////////////////////////////////////////////////////////////////////
 //                   POINTER TO POINTER ASSIGNMENT                        //
 ////////////////////////////////////////////////////////////////////////////
-template <class T, int size>
-Pointer<T, size> &Pointer<T, size>::operator=(Pointer &rv) {
+template <class T>
+Pointer<T> &Pointer<T>::operator=(Pointer &rv) {
+  GC_LOCK();
+  PtrDetailsBase *old = nullptr;
   // Avoid self-assignments.
-  if (* this!=rv) {
+  if (details != rv.details) {
     // As there is going to be a new pointer to the address pointing at by
-    // the given parameter t, the PtrDetails object must be updated.
-    typename std::list<PtrDetails<T>>::iterator p;
-    // The object should exist in the references container.
-    p = findPtrInfo(addr);
-    // First, update the reference count for that memory block.
-    p->downRefCount();
-    // Of course, the address has been referenced before, so exists in the 
-    // references container.
-    p = findPtrInfo(rv.addr);
-    // Update the reference count for that memory block.
-    p->upRefCount();
-    // Then we copy all the member instance info.
-    addr = rv.addr;
-    isArray = rv.isArray;
-    arraySize = rv.arraySize;
+    // the given parameter t, the PtrDetails objects must be updated.
+    // First, count the reference to the new memory block.
+    if (rv.details)
+      rv.details->upRefCount();
+    old = details;
+    details = rv.details;
   }
+  // Then we copy all the member instance info.
+  addr = rv.addr;
+  isArray = rv.isArray;
+  arraySize = rv.arraySize;
+  // Let go of the old block last: rv may live inside it.
+  letGo(old);
   // Return the address to the current Pointer object that has assigned
   // the content of the given rv parameter.
   return *this;
 }
 
+// Print a value from showlist(), or a placeholder for types
+// (such as abstract bases) that have no operator<<.
+template <class T, class = void> struct GCPrintable : std::false_type {};
+template <class T>
+struct GCPrintable<T, decltype(void(std::declval<std::ostream &>()
+                                     << std::declval<const T &>()))>
+    : std::true_type {};
+template <class T>
+typename std::enable_if<GCPrintable<T>::value>::type
+GCPrint(std::ostream &os, const T &value) {
+  os << " " << value;
+}
+template <class T>
+typename std::enable_if<!GCPrintable<T>::value>::type
+GCPrint(std::ostream &os, const T &) {
+  os << " <" << typeid(T).name() << ">";
+}
+
 // A utility function that displays refContainer.
-template <class T, int size> void Pointer<T, size>::showlist() {
+template <class T> void Pointer<T>::showlist() {
+  GC_LOCK();
   typename std::list<PtrDetails<T>>::iterator p;
-  std::cout << "refContainer<" << typeid(T).name() << ", " << size << ">:\n";
+  std::cout << "refContainer<" << typeid(T).name() << ">:\n";
   std::cout << "memPtr refcount value\n ";
-  if (refContainer.begin() == refContainer.end()) {
+  if (refContainer.empty() && largeContainer.empty()) {
     std::cout << " Container is empty!\n\n ";
   }
-  for (p = refContainer.begin(); p != refContainer.end(); p++) {
-    std::cout << "[" << (void *)p->memPtr << "]"
-              << " " << p->refCount << " ";
-    if (p->memPtr)
-      std::cout << " " << *p->memPtr;
-    else
-      std::cout << "---";
-    std::cout << std::endl;
-  }
+  // Large arrays are listed after the rest.
+  for (std::list<PtrDetails<T>> *list : {&refContainer, &largeContainer})
+    for (p = list->begin(); p != list->end(); p++) {
+      std::cout << "[" << (void *)p->memPtr << "]"
+                << " " << p->refCount << " ";
+      if (p->memPtr)
+        GCPrint(std::cout, *p->memPtr);
+      else
+        std::cout << "---";
+      std::cout << std::endl;
+    }
   std::cout << std::endl;
 }
 // Find a pointer in refContainer.
-template <class T, int size>
-typename std::list<PtrDetails<T>>::iterator
-Pointer<T, size>::findPtrInfo(T *ptr) {
+template <class T>
+PtrDetails<T> *Pointer<T>::findPtrInfo(T *ptr) {
+  GC_PERF_SAMPLED_SCOPE(FIND);
+  // Find ptr in refContainer, or among the large arrays if it is one.
+  // Expired entries hold a null memPtr and are never searched for, since
+  // null pointers are not tracked.
+  std::list<PtrDetails<T>> &list =
+      GCLargeObjects::contains(ptr) ? largeContainer : refContainer;
   typename std::list<PtrDetails<T>>::iterator p;
-  // Find ptr in refContainer.
-  for (p = refContainer.begin(); p != refContainer.end(); p++)
+  for (p = list.begin(); p != list.end(); p++)
     if (p->memPtr == ptr)
-      return p;
-  return p;
+      return &*p;
+  return nullptr;
+}
+template <class T>
+void Pointer<T>::snapshot(std::uint32_t type, std::vector<GCSnapshotBlock> &out) {
+  typename std::list<PtrDetails<T>>::iterator p;
+  for (std::list<PtrDetails<T>> *list : {&refContainer, &largeContainer})
+    for (p = list->begin(); p != list->end(); p++) {
+      // Expired entries only remain for their WeakPointers.
+      if (!p->memPtr)
+        continue;
+      GCSnapshotBlock b;
+      b.details = static_cast<PtrDetailsBase *>(&*p);
+      b.addr = p->memPtr;
+      b.bytes = sizeof(T) * (p->isArray ? p->arraySize : 1);
+      b.type = type;
+      b.refCount = p->refCount;
+      b.weakCount = p->weakCount;
+      b.flags = (p->isArray ? GCSnapshot::ARRAY : 0) |
+                (p->release ? GCSnapshot::DELETER : 0) |
+                (p->relocated ? GCSnapshot::RELOCATED : 0) |
+                (p->large ? GCSnapshot::LARGE : 0);
+      out.push_back(b);
+    }
 }
+
 // Clear refContainer when program exits.
-template <class T, int size> void Pointer<T, size>::shutdown() {
-  if (refContainerSize() == 0)
-    return; // list is empty
+template <class T> void Pointer<T>::shutdown() {
+  GC_LOCK();
+  // No early return on an empty list: the quarantine is drained below.
   typename std::list<PtrDetails<T>>::iterator p;
-  for (p = refContainer.begin(); p != refContainer.end(); p++) {
-    // Set all reference counts to zero
-    p->refCount = 0;
-  }
+  for (std::list<PtrDetails<T>> *list : {&refContainer, &largeContainer})
+    for (p = list->begin(); p != list->end(); p++) {
+      // Set all reference counts to zero
+      p->refCount = 0;
+    }
   collect();
+#ifdef GC_QUARANTINE
+  GCQuarantine::drain();
+#endif
 }
\ No newline at end of file
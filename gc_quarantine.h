@@ -0,0 +1,143 @@
+// Debug quarantine for collected blocks. With GC_QUARANTINE defined,
+// collect() destroys an unreferenced object, overwrites its memory with
+// a poison byte and parks the block in a bounded FIFO instead of freeing
+// it. A stale raw pointer (from operator T* or an Iter) that reads the
+// block then sees the poison pattern rather than a plausible value, and a
+// write through it is caught when the block leaves the FIFO and the
+// pattern is checked. Under AddressSanitizer the parked blocks are also
+// poisoned for ASan, so a stale read faults immediately.
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <type_traits>
+#if defined(__SANITIZE_ADDRESS__)
+#define GC_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define GC_ASAN 1
+#endif
+#endif
+#ifdef GC_ASAN
+#include <sanitizer/asan_interface.h>
+#endif
+
+#ifndef GC_QUARANTINE_ENTRIES
+#define GC_QUARANTINE_ENTRIES 1024 // blocks held at most
+#endif
+#ifndef GC_QUARANTINE_BYTES
+#define GC_QUARANTINE_BYTES (4 << 20) // bytes held at most
+#endif
+
+class GCQuarantine {
+public:
+  static const unsigned char POISON = 0xDD;
+
+  // Destroys the object(s) at ptr and quarantines the memory. Blocks the
+  // quarantine cannot give back correctly on its own are deleted as
+  // before: polymorphic objects (the dynamic type and size may differ
+  // from T) and arrays of non-trivially destructible T (whose array
+  // cookie hides the address operator new[] returned). Types with their
+  // own operator delete must not be managed while the quarantine is on.
+  template <class T> static void retire(T *ptr, bool isArray, unsigned arraySize) {
+    if (!ptr)
+      return;
+    if (isArray) {
+      if (!std::is_trivially_destructible<T>::value) {
+        delete[] ptr;
+        return;
+      }
+      instance().push(ptr, arraySize * sizeof(T), releaseArray<T>);
+    }
+    else {
+      if (std::has_virtual_destructor<T>::value) {
+        delete ptr;
+        return;
+      }
+      ptr->~T();
+      instance().push(ptr, sizeof(T), releaseObject<T>);
+    }
+  }
+  // Checks and frees every quarantined block. Called by Pointer::shutdown()
+  // so that the memory is returned before the program exits.
+  static void drain() {
+    GCQuarantine &q = instance();
+    while (q.count > 0)
+      q.pop();
+  }
+  static std::size_t size() { return instance().count; }
+  static std::size_t bytes() { return instance().held; }
+
+private:
+  struct Entry {
+    void *block;
+    std::size_t bytes;
+    void (*release)(void *, std::size_t);
+  };
+  Entry entries[GC_QUARANTINE_ENTRIES];
+  std::size_t first, count, held;
+
+  // Trivially constructible and destructible, so the instance is usable
+  // from atexit handlers regardless of destruction order.
+  static GCQuarantine &instance() {
+    static GCQuarantine q;
+    return q;
+  }
+  // Pair with the allocation functions new T / new T[n] used.
+  template <class T> static void releaseObject(void *block, std::size_t bytes) {
+#ifdef __cpp_aligned_new
+    if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      ::operator delete(block, bytes, std::align_val_t(alignof(T)));
+      return;
+    }
+#endif
+    ::operator delete(block, bytes);
+  }
+  template <class T> static void releaseArray(void *block, std::size_t) {
+#ifdef __cpp_aligned_new
+    if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      ::operator delete[](block, std::align_val_t(alignof(T)));
+      return;
+    }
+#endif
+    ::operator delete[](block);
+  }
+  void push(void *block, std::size_t bytes, void (*release)(void *, std::size_t)) {
+    std::memset(block, POISON, bytes);
+    if (bytes > GC_QUARANTINE_BYTES) {
+      release(block, bytes);
+      return;
+    }
+    while (count == GC_QUARANTINE_ENTRIES || held + bytes > GC_QUARANTINE_BYTES)
+      pop();
+#ifdef GC_ASAN
+    ASAN_POISON_MEMORY_REGION(block, bytes);
+#endif
+    Entry &e = entries[(first + count) % GC_QUARANTINE_ENTRIES];
+    e.block = block;
+    e.bytes = bytes;
+    e.release = release;
+    count++;
+    held += bytes;
+  }
+  // Releases the oldest block after checking that nothing wrote to it.
+  void pop() {
+    Entry e = entries[first];
+    first = (first + 1) % GC_QUARANTINE_ENTRIES;
+    count--;
+    held -= e.bytes;
+#ifdef GC_ASAN
+    ASAN_UNPOISON_MEMORY_REGION(e.block, e.bytes);
+#endif
+    const unsigned char *p = static_cast<const unsigned char *>(e.block);
+    for (std::size_t i = 0; i < e.bytes; i++)
+      if (p[i] != POISON) {
+        std::cerr << "GCQuarantine: block [" << e.block << "] of " << e.bytes
+                  << " bytes was written at offset " << i
+                  << " after it was collected\n";
+        std::abort();
+      }
+    e.release(e.block, e.bytes);
+  }
+};
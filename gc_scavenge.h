@@ -0,0 +1,202 @@
+// Returning freed memory to the OS. A collection that frees a large burst
+// leaves the pages it freed committed: in the mappings of large arrays
+// kept for reuse (gc_large.h), on the pages of compaction regions
+// (gc_compact.h) whose blocks are all gone, and in the malloc heap.
+// Only the first two are tracked page by page; every other block comes
+// from new, and its pages are malloc's to give back.
+// GCScavenger::scavenge() unmaps the cached large arrays, decommits the
+// empty region pages with madvise(MADV_DONTNEED), or MADV_FREE with
+// GC_DECOMMIT_LAZY defined, and on glibc calls malloc_trim(). One
+// retention target covers all three, filled in that order: what the
+// large-array cache keeps is not left for the regions, and only the rest
+// is passed to malloc_trim(), which keeps it at the top of its heap.
+// With GC_THREAD_SAFE, start() runs it on a background thread a while
+// after collections free memory, so the pause itself pays nothing;
+// otherwise call scavenge() when convenient. stats() reports committed
+// against used bytes.
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+#ifdef GC_THREAD_SAFE
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#endif
+
+#ifndef GC_SCAVENGE_RETAIN
+#define GC_SCAVENGE_RETAIN (4 << 20) // free bytes kept committed
+#endif
+#ifndef GC_SCAVENGE_INTERVAL
+#define GC_SCAVENGE_INTERVAL 100 // ms between background scavenges
+#endif
+
+struct GCScavengeStats {
+  std::size_t committed; // bytes regions and large arrays hold of the OS
+  std::size_t used;      // bytes of live blocks in them
+  std::size_t heapUsed;  // bytes malloc has handed out (glibc, else 0)
+  std::size_t heapFree;  // bytes free in the malloc heap (glibc, else 0)
+  std::size_t resident;  // resident set of the process (Linux, else 0)
+  std::size_t released;  // bytes decommitted or unmapped so far
+  std::size_t scavenges; // scavenge() calls so far
+};
+
+class GCScavenger {
+public:
+  // Free bytes each scavenge leaves committed, in the large-array
+  // cache, the regions and the malloc heap together.
+  static void setRetain(std::size_t bytes) {
+    GC_LOCK();
+    control().retain = bytes;
+  }
+  static std::size_t retain() { return control().retain; }
+
+  // Decommits empty pages beyond the retention target. Returns the
+  // bytes given back; what malloc_trim releases is not counted, but
+  // shows in stats().resident.
+  static std::size_t scavenge() {
+    Control &c = control();
+    c.pending.store(false, std::memory_order_relaxed);
+    std::size_t freed, keep;
+    {
+      GC_LOCK();
+      keep = c.retain;
+      // Cached large arrays are reused; empty region pages never are.
+      freed = GCLargeObjects::trim(keep);
+      keep -= std::min(keep, GCLargeObjects::cachedBytes());
+      freed += GCRegion::decommit(keep);
+      keep -= std::min(keep, GCRegion::emptyBytes());
+      c.released += freed;
+      c.scavenges++;
+    }
+#if defined(__GLIBC__)
+    // Takes malloc's own locks; the collector's is not needed.
+    malloc_trim(keep);
+#else
+    (void)keep;
+#endif
+    return freed;
+  }
+  // Called by collect() when it has freed memory.
+  static void notify() {
+    control().pending.store(true, std::memory_order_relaxed);
+  }
+
+  // Scavenges every interval ms, if a collection has freed memory since
+  // the last time. Returns false if already running or, without
+  // GC_THREAD_SAFE, always. The thread is stopped at exit.
+  static bool start(unsigned interval = GC_SCAVENGE_INTERVAL) {
+#ifdef GC_THREAD_SAFE
+    GC_LOCK();
+    Control &c = control();
+    if (c.worker)
+      return false;
+    void *m = std::malloc(sizeof(Worker));
+    if (!m)
+      return false;
+    if (!c.atExit)
+      c.atExit = std::atexit(stop) == 0;
+    c.worker = ::new (m) Worker();
+    c.worker->stopping = false;
+    c.worker->thread = std::thread(run, c.worker, interval);
+    return true;
+#else
+    (void)interval;
+    return false;
+#endif
+  }
+  static void stop() {
+#ifdef GC_THREAD_SAFE
+    Worker *w;
+    {
+      GC_LOCK();
+      w = control().worker;
+      control().worker = nullptr;
+    }
+    if (!w)
+      return;
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      w->stopping = true;
+    }
+    w->wake.notify_one();
+    w->thread.join();
+    w->~Worker();
+    std::free(w);
+#endif
+  }
+
+  static GCScavengeStats stats() {
+    GCScavengeStats s = GCScavengeStats();
+    {
+      GC_LOCK();
+      s.committed = GCRegion::committedBytes() + GCLargeObjects::bytes() +
+                    GCLargeObjects::cachedBytes();
+      s.used = GCRegion::usedBytes() + GCLargeObjects::bytes();
+      s.released = control().released;
+      s.scavenges = control().scavenges;
+    }
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    s.heapUsed = mi.uordblks + mi.hblkhd;
+    s.heapFree = mi.fordblks;
+#endif
+#ifdef __linux__
+    std::FILE *statm = std::fopen("/proc/self/statm", "r");
+    if (statm) {
+      unsigned long pages, rss;
+      if (std::fscanf(statm, "%lu %lu", &pages, &rss) == 2)
+        s.resident = rss * (std::size_t)sysconf(_SC_PAGESIZE);
+      std::fclose(statm);
+    }
+#endif
+    return s;
+  }
+
+private:
+#ifdef GC_THREAD_SAFE
+  struct Worker {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    bool stopping;
+  };
+  static void run(Worker *w, unsigned interval) {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    while (!w->wake.wait_for(lock, std::chrono::milliseconds(interval),
+                             [w] { return w->stopping; })) {
+      if (!control().pending.load(std::memory_order_relaxed))
+        continue;
+      lock.unlock();
+      scavenge();
+      lock.lock();
+    }
+  }
+#else
+  struct Worker;
+#endif
+  // Trivially destructible, so it outlives every static Pointer; the
+  // worker is allocated separately and stopped at exit.
+  struct Control {
+    std::atomic<bool> pending;
+    std::size_t retain;
+    std::size_t released;
+    std::size_t scavenges;
+    Worker *worker;
+    bool atExit;
+  };
+  static Control &control() {
+    static Control c = {{false}, GC_SCAVENGE_RETAIN, 0, 0, nullptr, false};
+    return c;
+  }
+};
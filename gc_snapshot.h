@@ -0,0 +1,142 @@
+// Heap snapshots. write_gc_snapshot() (in gc_pointer.h) streams every
+// block tracked by any Pointer type to a binary file: its address, size,
+// type, counts, and its edges, the blocks its Pointer and WeakPointer
+// members refer to. Objects have no tracing hooks, so the members are
+// found by scanning each block for the address of a refContainer entry:
+// Pointer stores it as is, WeakPointer with the WEAK bit set, so each
+// edge says which kind it is. Raw pointers are not edges,
+// and neither are Pointers in memory the collector does not manage (the
+// buffer of a std::vector member, say); tools/gc_snapshot_analyze.cpp
+// takes the blocks they refer to as roots. Sizes are sizeof(T) times the
+// array length; a block held through a base class is counted at the
+// base's size.
+//
+// File layout, in native byte order (check reads 0x01020304):
+//   header  char magic[8] "GCSNAP1", u32 version, u32 check, u32 types
+//   type    u32 length, char name[length] (typeid(T).name())
+//   block   u64 addr, u64 bytes, u32 type, u32 refCount, u32 weakCount,
+//           u32 flags, u32 edges, u64 target[edges] (bit 0 set if weak)
+//   end     a block with addr 0 and no edges
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#ifndef GC_SNAPSHOT_TYPES
+#define GC_SNAPSHOT_TYPES 1024 // Pointer types a snapshot can list
+#endif
+
+struct GCSnapshotBlock {
+  const void *details; // the refContainer entry
+  const void *addr;
+  std::size_t bytes;
+  std::uint32_t type;
+  std::uint32_t refCount;
+  std::uint32_t weakCount;
+  std::uint32_t flags;
+};
+
+class GCSnapshot {
+public:
+  static const char *magic() { return "GCSNAP1"; } // 8 bytes with the NUL
+  static const std::uint32_t VERSION = 1;
+  static const std::uint32_t CHECK = 0x01020304;
+  enum Flags { ARRAY = 1, DELETER = 2, RELOCATED = 4, LARGE = 8 };
+  // Set in the entry address a WeakPointer keeps, and in weak edges.
+  static const std::uintptr_t WEAK = 1;
+  typedef void (*Enumerate)(std::uint32_t type, std::vector<GCSnapshotBlock> &);
+
+  // Called once per Pointer type, with the collector lock held. Types
+  // beyond GC_SNAPSHOT_TYPES are left out of snapshots.
+  static void registerType(const char *name, Enumerate enumerate) {
+    Registry &r = registry();
+    if (r.count == GC_SNAPSHOT_TYPES)
+      return;
+    r.names[r.count] = name;
+    r.enumerate[r.count] = enumerate;
+    r.count++;
+  }
+  // Writes the snapshot to out. The caller holds the collector lock.
+  static bool write(std::FILE *out) {
+    Registry &r = registry();
+    std::vector<GCSnapshotBlock> blocks;
+    for (std::uint32_t t = 0; t < r.count; t++)
+      r.enumerate[t](t, blocks);
+    std::sort(blocks.begin(), blocks.end(),
+              [](const GCSnapshotBlock &a, const GCSnapshotBlock &b) {
+                return std::less<const void *>()(a.addr, b.addr);
+              });
+    bool ok = std::fwrite(magic(), 8, 1, out) == 1;
+    ok = ok && put32(out, VERSION) && put32(out, CHECK) && put32(out, r.count);
+    for (std::uint32_t t = 0; t < r.count; t++) {
+      std::uint32_t length = (std::uint32_t)std::strlen(r.names[t]);
+      ok = ok && put32(out, length) &&
+           std::fwrite(r.names[t], 1, length, out) == length;
+    }
+    std::unordered_map<std::uintptr_t, std::size_t> entries;
+    for (std::size_t i = 0; i < blocks.size(); i++)
+      entries[(std::uintptr_t)blocks[i].details] = i;
+    std::vector<std::uint64_t> edges;
+    for (std::size_t i = 0; ok && i < blocks.size(); i++) {
+      const GCSnapshotBlock &b = blocks[i];
+      findEdges(blocks, entries, i, edges);
+      ok = put64(out, (std::uintptr_t)b.addr) && put64(out, b.bytes) &&
+           put32(out, b.type) && put32(out, b.refCount) &&
+           put32(out, b.weakCount) && put32(out, b.flags) &&
+           put32(out, (std::uint32_t)edges.size());
+      for (std::size_t e = 0; ok && e < edges.size(); e++)
+        ok = put64(out, edges[e]);
+    }
+    // The end record.
+    for (int i = 0; i < 2; i++)
+      ok = ok && put64(out, 0);
+    for (int i = 0; i < 5; i++)
+      ok = ok && put32(out, 0);
+    return ok;
+  }
+
+private:
+  // Trivially destructible, so registering from static Pointers is safe
+  // in any order.
+  struct Registry {
+    std::uint32_t count;
+    const char *names[GC_SNAPSHOT_TYPES];
+    Enumerate enumerate[GC_SNAPSHOT_TYPES];
+  };
+  static Registry &registry() {
+    static Registry r;
+    return r;
+  }
+  // The Pointers and WeakPointers in blocks[i], as the start of the
+  // blocks they refer to, tagged with 1 if weak.
+  static void findEdges(const std::vector<GCSnapshotBlock> &blocks,
+                        const std::unordered_map<std::uintptr_t, std::size_t> &entries,
+                        std::size_t i, std::vector<std::uint64_t> &edges) {
+    edges.clear();
+    const GCSnapshotBlock &b = blocks[i];
+    std::size_t words = b.bytes / sizeof(void *);
+    if ((std::uintptr_t)b.addr % alignof(void *) != 0)
+      return;
+    const unsigned char *base = static_cast<const unsigned char *>(b.addr);
+    std::vector<std::uintptr_t> w(words);
+    if (words)
+      std::memcpy(&w[0], base, words * sizeof(void *));
+    for (std::size_t k = 0; k < words; k++) {
+      std::uintptr_t weak = w[k] & WEAK;
+      auto e = entries.find(w[k] & ~WEAK);
+      if (e != entries.end())
+        edges.push_back((std::uintptr_t)blocks[e->second].addr | weak);
+    }
+  }
+  static bool put32(std::FILE *out, std::uint32_t v) {
+    return std::fwrite(&v, sizeof(v), 1, out) == 1;
+  }
+  static bool put64(std::FILE *out, std::uint64_t v) {
+    return std::fwrite(&v, sizeof(v), 1, out) == 1;
+  }
+};
+
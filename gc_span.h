@@ -0,0 +1,120 @@
+// Non-owning views of the array a Pointer points to. Like
+// Iter, views ** do not ** participate in or affect garbage
+// collection: they carry the address and the length only,
+// so borrowing one costs no reference counting or
+// registry lookups, and a hot loop over a view's plain
+// T* begin()/end() is free to vectorize. A view must not
+// outlive the Pointer it was taken from.
+#include <cstddef>
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
+
+template <class T> class StridedSpan;
+
+// A contiguous run of elements, in the spirit of std::span.
+template <class T> class Span {
+  T *ptr;             // first element
+  std::size_t length; // number of elements
+public:
+  typedef T element_type;
+  typedef T *iterator;
+
+  Span() : ptr(nullptr), length(0) {}
+  Span(T *first, std::size_t count) : ptr(first), length(count) {}
+
+  T *data() const { return ptr; }
+  std::size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+  T *begin() const { return ptr; }
+  T *end() const { return ptr + length; }
+  // Unchecked element access.
+  T &operator[](std::size_t i) const { return ptr[i]; }
+  // Checked element access.
+  T &at(std::size_t i) const {
+    if (i >= length)
+      throw OutOfRangeExc();
+    return ptr[i];
+  }
+  // Sub-views. Do not allow views past the end.
+  Span subspan(std::size_t offset, std::size_t count) const {
+    if (offset > length || count > length - offset)
+      throw OutOfRangeExc();
+    return Span(ptr + offset, count);
+  }
+  Span first(std::size_t count) const { return subspan(0, count); }
+  Span last(std::size_t count) const {
+    if (count > length)
+      throw OutOfRangeExc();
+    return Span(ptr + length - count, count);
+  }
+  // Every step-th element, starting with the first.
+  StridedSpan<T> stride(std::size_t step) const;
+#if __cpp_lib_span
+  operator std::span<T>() const { return std::span<T>(ptr, length); }
+#endif
+};
+
+// Every stride-th element of an array, e.g. a column of
+// a row-major matrix.
+template <class T> class StridedSpan {
+  T *ptr;             // first element
+  std::size_t length; // number of elements in the view
+  std::size_t step;   // distance between them, in elements
+public:
+  StridedSpan() : ptr(nullptr), length(0), step(1) {}
+  StridedSpan(T *first, std::size_t count, std::size_t stride)
+      : ptr(first), length(count), step(stride) {}
+
+  T *data() const { return ptr; }
+  std::size_t size() const { return length; }
+  std::size_t stride() const { return step; }
+  bool empty() const { return length == 0; }
+  T &operator[](std::size_t i) const { return ptr[i * step]; }
+  T &at(std::size_t i) const {
+    if (i >= length)
+      throw OutOfRangeExc();
+    return ptr[i * step];
+  }
+};
+
+template <class T> StridedSpan<T> Span<T>::stride(std::size_t step) const {
+  if (step == 0)
+    throw OutOfRangeExc();
+  return StridedSpan<T>(ptr, (length + step - 1) / step, step);
+}
+
+// A row-major matrix laid over an array.
+template <class T> class Span2D {
+  T *ptr;
+  std::size_t nrows, ncols;
+public:
+  Span2D() : ptr(nullptr), nrows(0), ncols(0) {}
+  Span2D(T *first, std::size_t rows, std::size_t cols)
+      : ptr(first), nrows(rows), ncols(cols) {}
+
+  T *data() const { return ptr; }
+  std::size_t rows() const { return nrows; }
+  std::size_t cols() const { return ncols; }
+  std::size_t size() const { return nrows * ncols; }
+  // Unchecked element access.
+  T &operator()(std::size_t r, std::size_t c) const { return ptr[r * ncols + c]; }
+  // Checked element access.
+  T &at(std::size_t r, std::size_t c) const {
+    if (r >= nrows || c >= ncols)
+      throw OutOfRangeExc();
+    return ptr[r * ncols + c];
+  }
+  Span<T> row(std::size_t r) const {
+    if (r >= nrows)
+      throw OutOfRangeExc();
+    return Span<T>(ptr + r * ncols, ncols);
+  }
+  StridedSpan<T> column(std::size_t c) const {
+    if (c >= ncols)
+      throw OutOfRangeExc();
+    return StridedSpan<T>(ptr + c, nrows, ncols);
+  }
+  // The whole matrix as one contiguous run.
+  Span<T> flat() const { return Span<T>(ptr, nrows * ncols); }
+};
@@ -0,0 +1,169 @@
+// Pause-time tracer. With GC_TRACE defined, collect() records begin/end
+// events for the whole collection ("collect"), each sweep over
+// refContainer ("sweep") and each batch of blocks freed after a sweep
+// ("finalize"), plus a counter with the size of refContainer after every
+// collection. Events go into a fixed ring that threads append to without
+// locking (the oldest events are overwritten), and GCTrace::dump() writes
+// them as Chrome trace_event JSON for chrome://tracing or Perfetto.
+// Programs can add their own spans with GCTrace::begin()/end() or
+// GCTraceScope so that they line up with the collections.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#ifndef GC_TRACE_EVENTS
+#define GC_TRACE_EVENTS 65536 // events kept in the ring
+#endif
+
+class GCTrace {
+public:
+  // name and detail must outlive the trace (string literals, typeid names).
+  static void begin(const char *name, const char *detail = nullptr) {
+    instance().record('B', name, detail, 0);
+  }
+  static void end(const char *name, const char *detail = nullptr) {
+    instance().record('E', name, detail, 0);
+  }
+  static void counter(const char *name, const char *detail, long long value) {
+    instance().record('C', name, detail, value);
+  }
+  // Number of events recorded so far, including overwritten ones.
+  static unsigned long long recorded() {
+    return instance().head.load(std::memory_order_relaxed);
+  }
+  // Writes the events still in the ring to path as a JSON trace. Events
+  // being recorded meanwhile may be left out. Returns false if the file
+  // cannot be written.
+  static bool dump(const char *path) {
+    std::FILE *out = std::fopen(path, "w");
+    if (!out)
+      return false;
+    instance().write(out);
+    return std::fclose(out) == 0;
+  }
+
+private:
+  // The fields are atomics so that dump() can read a slot that is being
+  // rewritten; seq tells whether the copy it made is consistent.
+  struct Slot {
+    std::atomic<unsigned long long> seq; // 2 * index + 2 once written
+    std::atomic<const char *> name;
+    std::atomic<const char *> detail;
+    std::atomic<long long> value;
+    std::atomic<unsigned long long> ns;
+    std::atomic<unsigned> tid;
+    std::atomic<char> phase;
+  };
+  Slot slots[GC_TRACE_EVENTS];
+  std::atomic<unsigned long long> head;
+  std::chrono::steady_clock::time_point start;
+
+  GCTrace() : head(0), start(std::chrono::steady_clock::now()) {
+    for (unsigned i = 0; i < GC_TRACE_EVENTS; i++)
+      slots[i].seq.store(0, std::memory_order_relaxed);
+  }
+  static GCTrace &instance() {
+    static GCTrace trace;
+    return trace;
+  }
+  // Small, stable thread numbers for the tid field.
+  static unsigned threadId() {
+    static std::atomic<unsigned> next(1);
+    thread_local unsigned id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+  }
+  void record(char phase, const char *name, const char *detail, long long value) {
+    unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    unsigned long long i = head.fetch_add(1, std::memory_order_relaxed);
+    Slot &s = slots[i % GC_TRACE_EVENTS];
+    // Release stores keep the fields after the odd seq, which marks the
+    // slot as being written; the reader's acquire loads mirror this.
+    s.seq.store(2 * i + 1, std::memory_order_relaxed);
+    s.name.store(name, std::memory_order_release);
+    s.detail.store(detail, std::memory_order_release);
+    s.value.store(value, std::memory_order_release);
+    s.ns.store(ns, std::memory_order_release);
+    s.tid.store(threadId(), std::memory_order_release);
+    s.phase.store(phase, std::memory_order_release);
+    s.seq.store(2 * i + 2, std::memory_order_release);
+  }
+  void write(std::FILE *out) {
+#if defined(__unix__) || defined(__APPLE__)
+    long pid = getpid();
+#else
+    long pid = 1;
+#endif
+    unsigned long long last = head.load(std::memory_order_acquire);
+    unsigned long long i = last > GC_TRACE_EVENTS ? last - GC_TRACE_EVENTS : 0;
+    bool first = true;
+    std::fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (; i < last; i++) {
+      Slot &s = slots[i % GC_TRACE_EVENTS];
+      if (s.seq.load(std::memory_order_acquire) != 2 * i + 2)
+        continue;
+      const char *name = s.name.load(std::memory_order_acquire);
+      const char *detail = s.detail.load(std::memory_order_acquire);
+      long long value = s.value.load(std::memory_order_acquire);
+      unsigned long long ns = s.ns.load(std::memory_order_acquire);
+      unsigned tid = s.tid.load(std::memory_order_acquire);
+      char phase = s.phase.load(std::memory_order_acquire);
+      if (s.seq.load(std::memory_order_relaxed) != 2 * i + 2)
+        continue;
+      std::fprintf(out, "%s\n{\"name\":\"", first ? "" : ",");
+      writeString(out, name);
+      if (phase == 'C' && detail) {
+        std::fputc(' ', out);
+        writeString(out, detail);
+      }
+      std::fprintf(out, "\",\"cat\":\"gc\",\"ph\":\"%c\",\"ts\":%llu.%03llu,"
+                   "\"pid\":%ld,\"tid\":%u", phase, ns / 1000, ns % 1000, pid, tid);
+      if (phase == 'C') {
+        std::fprintf(out, ",\"args\":{\"value\":%lld}", value);
+      }
+      else if (detail) {
+        std::fprintf(out, ",\"args\":{\"type\":\"");
+        writeString(out, detail);
+        std::fprintf(out, "\"}");
+      }
+      std::fputc('}', out);
+      first = false;
+    }
+    std::fprintf(out, "\n]}\n");
+  }
+  static void writeString(std::FILE *out, const char *s) {
+    for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+        std::fputc('\\', out);
+      if ((unsigned char)*s >= 0x20)
+        std::fputc(*s, out);
+    }
+  }
+};
+
+// Records a begin event now and the matching end event when it goes out
+// of scope.
+class GCTraceScope {
+  const char *name;
+  const char *detail;
+public:
+  GCTraceScope(const char *n, const char *d = nullptr) : name(n), detail(d) {
+    GCTrace::begin(name, detail);
+  }
+  ~GCTraceScope() { GCTrace::end(name, detail); }
+};
+
+// The hooks in gc_pointer.h compile to nothing without GC_TRACE.
+#ifdef GC_TRACE
+#define GC_TRACE_CONCAT2(a, b) a##b
+#define GC_TRACE_CONCAT(a, b) GC_TRACE_CONCAT2(a, b)
+#define GC_TRACE_SCOPE(name, detail)                                           \
+  GCTraceScope GC_TRACE_CONCAT(gcTraceScope, __LINE__)(name, detail)
+#define GC_TRACE_COUNTER(name, detail, value) GCTrace::counter(name, detail, value)
+#else
+#define GC_TRACE_SCOPE(name, detail)
+#define GC_TRACE_COUNTER(name, detail, value)
+#endif
@@ -0,0 +1,14 @@
+// The programs in tests/ are run by ctest, which takes a nonzero exit
+// status as a failure. CHECK(cond) prints the condition that does not
+// hold and exits with status 1.
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(cond)                                                        \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,         \
+                   __LINE__, #cond);                                       \
+      std::exit(1);                                                        \
+    }                                                                      \
+  } while (0)
@@ -0,0 +1,33 @@
+// A deleter that throws out of collect(): the exception reaches the
+// caller, the collector is not left marked as collecting, and the other
+// garbage is freed by the next collection.
+#include "../gc_pointer.h"
+#include "check.h"
+
+struct Throwing {
+  void operator()(int *p) {
+    delete p;
+    throw 1;
+  }
+};
+
+int main() {
+  Pointer<int> bad(new int(1), Throwing());
+  Pointer<int> good = make_gc<int>(2);
+  WeakPointer<int> weak = good;
+  // Assignment does not collect, so nothing is freed yet.
+  bad = static_cast<int *>(nullptr);
+  good = static_cast<int *>(nullptr);
+  CHECK(Pointer<int>::refContainerSize() == 2);
+  bool threw = false;
+  try {
+    Pointer<int>::collect();
+  } catch (int) {
+    threw = true;
+  }
+  CHECK(threw);
+  Pointer<int>::collect();
+  CHECK(weak.expired());
+  CHECK(Pointer<int>::refContainerSize() == 1);
+  return 0;
+}
@@ -0,0 +1,67 @@
+// Compaction of a relocatable type: Pointers follow the blocks into one
+// region, a second compaction leaves the old region, and regions are
+// unmapped once their blocks are freed.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <vector>
+
+struct Particle {
+  long id;
+  double x;
+  Pointer<Particle> next;
+};
+template <> struct GCRelocatable<Particle> : std::true_type {};
+template <> struct GCRelocatable<float> : std::true_type {};
+
+long walk(Pointer<Particle> p, long *sum) {
+  long n = 0;
+  for (*sum = 0; p; p = p->next, n++)
+    *sum += p->id;
+  return n;
+}
+
+int main() {
+  std::vector<int *> others;
+  Pointer<Particle> head;
+  for (long i = 0; i < 3000; i++) {
+    Pointer<Particle> p = make_gc<Particle>();
+    p->id = i;
+    others.push_back(new int(0)); // keep the blocks apart
+    if (i % 3 == 0) {
+      p->next = head;
+      head = p;
+    }
+  }
+  Pointer<float> floats = make_gc_array<float>(100);
+  floats[99] = 3.5f;
+  long sum;
+  CHECK(walk(head, &sum) == 1000 && sum == 1000 * 2997 / 2);
+
+  CHECK(Pointer<Particle>::compact() == 1000);
+  CHECK(Pointer<float>::compact() == 1 && floats[99] == 3.5f);
+  CHECK(GCRegion::regions() == 2);
+  // Moved in allocation order, so the list runs backwards through them.
+  Particle *first = head;
+  CHECK(first - (Particle *)head->next == 1);
+  CHECK(walk(head, &sum) == 1000 && sum == 1000 * 2997 / 2);
+
+  // The blocks leave the first region, which goes away.
+  CHECK(Pointer<Particle>::compact() == 1000);
+  CHECK(GCRegion::regions() == 2);
+  CHECK(walk(head, &sum) == 1000 && sum == 1000 * 2997 / 2);
+
+  {
+    WeakPointer<Particle> weak = head;
+    head = static_cast<Particle *>(nullptr);
+    Pointer<Particle>::collect();
+    CHECK(weak.expired());
+  }
+  Pointer<Particle>::collect();
+  CHECK(Pointer<Particle>::refContainerSize() == 0);
+  floats = static_cast<float *>(nullptr);
+  Pointer<float>::collect();
+  CHECK(GCRegion::regions() == 0 && GCRegion::bytes() == 0);
+  for (int *p : others)
+    delete p;
+  return 0;
+}
@@ -0,0 +1,57 @@
+// With GC_THREAD_SAFE, compact() waits for threads that hold a
+// GCRelocationGuard, so they never see a block half moved, and moves
+// nothing while its own thread holds one.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct Cell {
+  long value;
+  Pointer<Cell> next;
+};
+template <> struct GCRelocatable<Cell> : std::true_type {};
+
+int main() {
+  const int THREADS = 3, CELLS = 200;
+  Pointer<Cell> head;
+  {
+    GCRelocationGuard guard;
+    for (long i = 0; i < CELLS; i++) {
+      Pointer<Cell> c = make_gc<Cell>();
+      c->value = i;
+      c->next = head;
+      head = c;
+    }
+  }
+  std::atomic<bool> done(false);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; t++)
+    threads.emplace_back([&head, &done] {
+      while (!done) {
+        GCRelocationGuard guard;
+        long sum = 0;
+        for (Pointer<Cell> c = head; c; c = c->next)
+          sum += c->value;
+        CHECK(sum == (long)CELLS * (CELLS - 1) / 2);
+      }
+    });
+  for (int i = 0; i < 50; i++)
+    CHECK(Pointer<Cell>::compact() == CELLS);
+  done = true;
+  for (std::thread &t : threads)
+    t.join();
+
+  {
+    GCRelocationGuard guard;
+    Cell *before = head;
+    CHECK(Pointer<Cell>::compact() == 0);
+    CHECK((Cell *)head == before);
+  }
+  CHECK(Pointer<Cell>::compact() == CELLS);
+  head = static_cast<Cell *>(nullptr);
+  Pointer<Cell>::collect();
+  CHECK(Pointer<Cell>::refContainerSize() == 0);
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Custom deleters, kept in the entry or on the heap, run once when the
+// memory becomes garbage; if storing one fails, the memory is freed with
+// it and no entry is left behind.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <new>
+#include <string>
+
+int freed = 0;
+
+struct Small {
+  void operator()(int *p) {
+    freed++;
+    delete p;
+  }
+};
+
+struct Big {
+  std::string name;
+  void operator()(int *p) {
+    CHECK(name == "big deleter, kept on the heap");
+    freed++;
+    delete p;
+  }
+};
+
+// Storing it on the heap fails.
+struct Unstorable : Small {
+  char pad[64];
+  static void *operator new(std::size_t) { throw std::bad_alloc(); }
+  static void operator delete(void *) {}
+};
+
+// Kept on the heap, which fails; it must still free the memory whole.
+struct NamedUnstorable {
+  std::string name;
+  void operator()(int *p) {
+    CHECK(name == "named deleter, never stored");
+    freed++;
+    delete p;
+  }
+  static void *operator new(std::size_t) { throw std::bad_alloc(); }
+  static void operator delete(void *) {}
+};
+
+int main() {
+  {
+    Pointer<int> a(new int(1), Small());
+    Pointer<int> b(new int(2), Big{"big deleter, kept on the heap"});
+    Pointer<int> c = make_gc_array<int>(4);
+    // Already tracked: the first deleter stays.
+    Pointer<int> d(static_cast<int *>(a), Big{"unused"});
+    CHECK(*d == 1 && Pointer<int>::refContainerSize() == 3);
+  }
+  CHECK(freed == 2 && Pointer<int>::refContainerSize() == 0);
+
+  bool threw = false;
+  try {
+    Pointer<int> e(new int(3), Unstorable());
+  } catch (std::bad_alloc &) {
+    threw = true;
+  }
+  CHECK(threw && freed == 3 && Pointer<int>::refContainerSize() == 0);
+
+  threw = false;
+  try {
+    Pointer<int> f(new int(4), NamedUnstorable{"named deleter, never stored"});
+  } catch (std::bad_alloc &) {
+    threw = true;
+  }
+  CHECK(threw && freed == 4 && Pointer<int>::refContainerSize() == 0);
+  return 0;
+}
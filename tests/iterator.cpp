@@ -0,0 +1,41 @@
+// Iters over Pointer arrays: begin() and end() are unchecked in every
+// build, and a CheckedIter made from them throws on out-of-range access.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <algorithm>
+#include <numeric>
+
+static_assert(std::is_same<Pointer<int>::GCiterator, Iter<int, false>>::value,
+              "Pointer's Iters are the same type in every build");
+static_assert(std::is_same<decltype(std::declval<Pointer<int> &>().begin()),
+                           Iter<int>>::value,
+              "begin() returns Pointer's Iter");
+
+int main() {
+  Pointer<int> a = make_gc_array<int>(8);
+  std::iota(a.begin(), a.end(), 0);
+  CHECK(std::accumulate(a.begin(), a.end(), 0) == 28);
+  std::reverse(a.begin(), a.end());
+  CHECK(a[0] == 7 && a[7] == 0);
+
+  CheckedIter<int> first = a.begin(), last = a.end();
+  CHECK(last - first == 8 && first[7] == 0 && *(last - 1) == 0);
+  bool threw = false;
+  try {
+    *last;
+  } catch (OutOfRangeExc &) {
+    threw = true;
+  }
+  CHECK(threw);
+  threw = false;
+  try {
+    first[8];
+  } catch (OutOfRangeExc &) {
+    threw = true;
+  }
+  CHECK(threw);
+  // And back, for code that takes Pointer's own Iters.
+  Iter<int> unchecked = first + 1;
+  CHECK(*unchecked == 6);
+  return 0;
+}
@@ -0,0 +1,16 @@
+// Iter under C++20: unchecked Iters are contiguous iterators, checked ones
+// only random-access, since their operator-> throws at end().
+#include "../gc_pointer.h"
+#include "check.h"
+#include <iterator>
+#include <memory>
+
+static_assert(std::contiguous_iterator<Iter<int>>);
+static_assert(std::random_access_iterator<CheckedIter<int>>);
+static_assert(!std::contiguous_iterator<CheckedIter<int>>);
+
+int main() {
+  Pointer<int> a = make_gc_array<int>(4);
+  CHECK(std::to_address(a.end()) == &a[0] + 4);
+  return 0;
+}
@@ -0,0 +1,45 @@
+// Large arrays: letting go of one still collects the small garbage of
+// its type, collectLarge() frees only the large ones, and a Pointer of a
+// fixed size only takes an array of that size.
+#include "../gc_pointer.h"
+#include "check.h"
+
+int main() {
+  const unsigned LARGE = GC_LARGE_OBJECT / sizeof(int);
+  // Assigning does not collect, so the small array is left as garbage.
+  Pointer<int> small = make_gc_array<int>(10);
+  small = static_cast<int *>(nullptr);
+  {
+    Pointer<int> big = make_gc_array<int>(LARGE);
+    CHECK(GCLargeObjects::objects() == 1);
+    CHECK(Pointer<int>::refContainerSize() == 2);
+  }
+  CHECK(GCLargeObjects::objects() == 0);
+  CHECK(Pointer<int>::refContainerSize() == 0);
+
+  // collectLarge() leaves the small garbage for collect().
+  Pointer<int> big = make_gc_array<int>(LARGE);
+  small = make_gc_array<int>(10);
+  small = static_cast<int *>(nullptr);
+  big = static_cast<int *>(nullptr);
+  CHECK(Pointer<int>::collectLarge());
+  CHECK(GCLargeObjects::objects() == 0);
+  CHECK(Pointer<int>::refContainerSize() == 1);
+  CHECK(Pointer<int>::collect());
+  CHECK(Pointer<int>::refContainerSize() == 0);
+
+  {
+    Pointer<int, 10> ten = make_gc_array<int>(10);
+    ten[9] = 1;
+    Pointer<int, 10> none = Pointer<int>();
+    bool threw = false;
+    try {
+      Pointer<int, 10> wrong = make_gc_array<int>(11);
+    } catch (OutOfRangeExc &) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+  CHECK(Pointer<int>::refContainerSize() == 0);
+  return 0;
+}
@@ -0,0 +1,43 @@
+// Over-aligned types through LeakTester: every allocation keeps its
+// alignment, aligned releases are matched, and the one block leaked on
+// purpose is the only one in the final report, with its size. ctest
+// matches the report (see CMakeLists.txt).
+#include "../gc_pointer.h"
+#include "../LeakTester.h"
+#include "check.h"
+#include <cstdint>
+
+struct alignas(64) Line {
+  char bytes[64];
+};
+struct alignas(128) Pair {
+  char bytes[128];
+};
+struct alignas(4096) Page {
+  char bytes[4096];
+};
+
+template <class T> bool aligned(const T *p) {
+  return (std::uintptr_t)p % alignof(T) == 0;
+}
+
+int main() {
+  Line *line = new Line;
+  Line *lines = new Line[3];
+  Page *page = new Page;
+  Page *pages = new Page[2];
+  CHECK(aligned(line) && aligned(lines) && aligned(page) && aligned(pages));
+  delete line;
+  delete[] lines;
+  delete page;
+  delete[] pages;
+  {
+    Pointer<Line> p = make_gc<Line>();
+    Pointer<Page> q = make_gc_array<Page>(4);
+    CHECK(aligned(&*p) && aligned(&q[0]) && aligned(&q[3]));
+  }
+  // Leaked on purpose.
+  Pair *pair = LEAK_NEW Pair;
+  CHECK(aligned(pair));
+  return 0;
+}
@@ -0,0 +1,37 @@
+// LeakTester's guard modes: CHECK_CANARIES passes clean blocks and reports
+// a block written past either end, with canaries or with a guard page
+// (whose alignment padding is checked like a canary). ctest matches the
+// reports; the damage is repaired before the blocks are released.
+#include "../LeakTester.h"
+#include "check.h"
+
+int main() {
+  GUARD_MODE(CANARY_GUARD, 0);
+  char *clean = LEAK_NEW char[8];
+  char *damaged = LEAK_NEW char[8];
+  std::memset(clean, 1, 8);
+  CHECK(CHECK_CANARIES == 0);
+  damaged[8] = 1;
+  CHECK(CHECK_CANARIES == 1);
+  damaged[8] = (char)__Tester__::CANARY;
+  damaged[-1] = 1;
+  CHECK(CHECK_CANARIES == 1);
+  damaged[-1] = (char)__Tester__::CANARY;
+  CHECK(CHECK_CANARIES == 0);
+
+  GUARD_MODE(PAGE_GUARD, 0);
+  char *paged = LEAK_NEW char[8];
+  std::memset(paged, 1, 8);
+  CHECK(CHECK_CANARIES == 0);
+#ifdef LEAK_TESTER_PAGE_GUARD
+  paged[8] = 1;
+  CHECK(CHECK_CANARIES == 1);
+  paged[8] = (char)__Tester__::CANARY;
+  CHECK(CHECK_CANARIES == 0);
+#endif
+  GUARD_MODE(NO_GUARD, 0);
+  delete[] clean;
+  delete[] damaged;
+  delete[] paged;
+  return 0;
+}
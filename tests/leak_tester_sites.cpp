@@ -0,0 +1,30 @@
+// LeakTester's allocation sites. Without LEAK_TESTER_NEW_MACRO the new
+// keyword is left alone, so placement new and the other well-formed uses
+// below compile; LEAK_NEW records where the block leaked on purpose was
+// allocated, which ctest matches in the report (see CMakeLists.txt).
+#include "../LeakTester.h"
+#include "check.h"
+
+struct Counter {
+  int value;
+  explicit Counter(int v) : value(v) {}
+};
+
+int main() {
+  alignas(Counter) unsigned char buffer[sizeof(Counter)];
+  Counter *placed = new (buffer) Counter(1);
+  Counter *other = ::new (buffer) Counter(2);
+  CHECK(placed == other && placed->value == 2);
+  int &three = *new int(3);
+  int value = three + 1;
+  delete &three;
+  decltype(new int) ignored = nullptr;
+  static_assert(!noexcept(new int), "operator new may throw");
+  CHECK(value == 4 && !ignored);
+  Counter *tracked = LEAK_NEW Counter(5);
+  delete tracked;
+  // Leaked on purpose: the line appears in the report.
+  Counter *leaked = LEAK_NEW Counter(6);
+  CHECK(leaked->value == 6);
+  return 0;
+}
@@ -0,0 +1,41 @@
+// Sized and aligned operator delete through LeakTester, built with
+// -fsized-deallocation: releases of LEAK_NEW blocks, plain and aligned,
+// single and array, are matched without complaint, and the one release
+// that claims a wrong size on purpose is reported (ctest matches it).
+#include "../LeakTester.h"
+#include "check.h"
+#include <new>
+
+struct Counter {
+  int value;
+  explicit Counter(int v) : value(v) {}
+  ~Counter() { value = -1; }
+};
+struct alignas(64) Line {
+  char bytes[64];
+  ~Line() {}
+};
+
+int main() {
+  Counter *one = LEAK_NEW Counter(1);
+  Counter *three = LEAK_NEW Counter[3]{Counter(1), Counter(2), Counter(3)};
+  Line *line = LEAK_NEW Line;
+  Line *lines = LEAK_NEW Line[2];
+  CHECK(one->value + three[2].value == 4);
+  delete one;
+  delete[] three;
+  delete line;
+  delete[] lines;
+
+  // The same releases, spelled out.
+  void *block = ::operator new(sizeof(Counter), __FILE__, __LINE__, "main");
+  ::operator delete(block, sizeof(Counter));
+  block = ::operator new(sizeof(Line), std::align_val_t(alignof(Line)),
+                         __FILE__, __LINE__, "main");
+  ::operator delete(block, sizeof(Line), std::align_val_t(alignof(Line)));
+
+  // Claims one byte less than was allocated.
+  block = ::operator new(4, __FILE__, __LINE__, "main");
+  ::operator delete(block, std::size_t(3));
+  return 0;
+}
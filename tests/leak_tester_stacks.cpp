@@ -0,0 +1,21 @@
+// LeakTester's call stacks: blocks leaked from one allocation site are
+// grouped by the stack that reached it, so the leaks made through the
+// same call below form one group printed with a single stack, and the
+// leak made through the other call forms its own (ctest matches the
+// report).
+#include "../LeakTester.h"
+#include "check.h"
+
+LEAK_TESTER_NOINLINE int *leak(int value) {
+  return LEAK_NEW int(value);
+}
+
+int main() {
+  STACK_TRACES(4, 1);
+  int sum = 0;
+  for (int i = 0; i < 3; i++)
+    sum += *leak(i);
+  sum += *leak(3);
+  CHECK(sum == 6);
+  return 0;
+}
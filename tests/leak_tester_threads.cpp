@@ -0,0 +1,40 @@
+// LeakTester from several threads at once: the per-thread counters add up
+// to every allocation and release, and the blocks each thread leaks on
+// purpose from one line are reported as one group (ctest matches the
+// report).
+#include "../LeakTester.h"
+#include "check.h"
+#include <thread>
+#include <vector>
+
+int main() {
+  const int THREADS = 4, ROUNDS = 2000;
+  std::vector<std::thread> threads;
+  threads.reserve(THREADS);
+  __Tester__::Totals before = __Tester__::Sum();
+  for (int t = 0; t < THREADS; t++)
+    threads.emplace_back([] {
+      char *held[16] = {};
+      for (int i = 0; i < ROUNDS; i++) {
+        char *&slot = held[i % 16];
+        delete[] slot;
+        slot = LEAK_NEW char[1 + i % 64];
+      }
+      for (char *p : held)
+        delete[] p;
+      // Leaked on purpose: one group for all threads.
+      long *leaked = LEAK_NEW long(1);
+      CHECK(*leaked == 1);
+    });
+  for (std::thread &t : threads)
+    t.join();
+  __Tester__::Totals after = __Tester__::Sum();
+  long allocs = after.alloc_count - before.alloc_count,
+       releases = after.dealloc_count - before.dealloc_count;
+  CHECK(allocs >= THREADS * (ROUNDS + 1));
+  CHECK(allocs - releases == THREADS);
+  CHECK((after.alloc_total - before.alloc_total) -
+            (after.dealloc_total - before.dealloc_total) ==
+        THREADS * (long)sizeof(long));
+  return 0;
+}
@@ -0,0 +1,20 @@
+// LeakTester's timeline: the snapshot taken when an allocation raises the
+// peak includes that allocation.
+#include "../LeakTester.h"
+#include "check.h"
+
+int main() {
+  TIMELINE(1, 0, leak_tester_timeline.csv);
+  // Through LEAK_NEW, which sanitizer runtimes that replace the plain
+  // operator new leave to LeakTester.
+  char *big = LEAK_NEW char[1 << 20];
+  CHECK(__Tester__::timeline.count > 0);
+  __Tester__::Snapshot &last =
+      __Tester__::timeline.snapshots[__Tester__::timeline.count - 1];
+  bool found = false;
+  for (std::size_t i = 0; i < last.count; i++)
+    found = found || last.sites[i].bytes >= (1 << 20);
+  CHECK(found);
+  delete[] big;
+  return 0;
+}
@@ -0,0 +1,44 @@
+// With GC_PERF, the collector's hooks add to GCPerf's totals: with a PMU,
+// every collection and its sweeps are measured and one in GC_PERF_SAMPLE
+// hot path calls; without one (most VMs and containers), nothing is.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <cstdio>
+
+int main() {
+  for (int i = 0; i < 4 * GC_PERF_SAMPLE; i++)
+    make_gc<int>(i);
+  CHECK(!Pointer<int>::collect());
+  GCPerfStats collect = GCPerf::stats(GCPerf::COLLECT);
+  GCPerfStats sweep = GCPerf::stats(GCPerf::SWEEP);
+  GCPerfStats destroy = GCPerf::stats(GCPerf::DESTROY);
+  if (!GCPerf::available()) {
+    for (int p = 0; p < GCPerf::PHASES; p++) {
+      GCPerfStats s = GCPerf::stats(GCPerf::Phase(p));
+      CHECK(s.samples == 0 && s.cycles == 0 && s.instructions == 0 &&
+            s.cacheMisses == 0 && s.branchMisses == 0);
+    }
+  }
+  else {
+    // At most one collect() per destroyed Pointer, and the one above;
+    // a read the kernel fails is not counted.
+    CHECK(collect.samples > 0 && collect.samples <= 4 * GC_PERF_SAMPLE + 1);
+    CHECK(sweep.samples >= collect.samples);
+    CHECK(destroy.samples <= 4);
+    if (GCPerf::available(GCPerf::INSTRUCTIONS))
+      CHECK(collect.instructions > 0 &&
+            collect.instructions >= sweep.instructions);
+  }
+  std::FILE *out = std::tmpfile();
+  CHECK(out);
+  GCPerf::report(out);
+  std::rewind(out);
+  int lines = 0;
+  for (int c; (c = std::fgetc(out)) != EOF;)
+    lines += c == '\n';
+  std::fclose(out);
+  CHECK(lines == 1 + GCPerf::PHASES);
+  GCPerf::reset();
+  CHECK(GCPerf::stats(GCPerf::COLLECT).samples == 0);
+  return 0;
+}
@@ -0,0 +1,61 @@
+// The persistent heap: a structure stored under a root is found again
+// after the heap is closed and reopened, and while one process has the
+// heap open another cannot open it.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Node {
+  long value;
+  PersistentPointer<Node> next;
+};
+
+int main() {
+  char path[] = "/tmp/gc_persistent_testXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  close(fd);
+
+  // The child waits until the heap is open, then tries to open it too.
+  int ready[2];
+  CHECK(pipe(ready) == 0);
+  pid_t child = fork();
+  CHECK(child >= 0);
+  if (child == 0) {
+    char c;
+    bool opened = read(ready[0], &c, 1) == 1 &&
+                  GCPersistentHeap::open(path, 1 << 20);
+    std::_Exit(opened ? 1 : 0);
+  }
+
+  CHECK(GCPersistentHeap::open(path, 1 << 20));
+  CHECK(write(ready[1], "x", 1) == 1);
+  int status;
+  CHECK(waitpid(child, &status, 0) == child);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  {
+    PersistentPointer<Node> head;
+    for (long i = 0; i < 100; i++) {
+      PersistentPointer<Node> node = make_persistent<Node>();
+      node->value = i;
+      node->next = head;
+      head = node;
+    }
+    CHECK(GCPersistentHeap::setRoot("list", head));
+  }
+  CHECK(GCPersistentHeap::close());
+
+  CHECK(GCPersistentHeap::open(path, 1 << 20));
+  CHECK(GCPersistentHeap::wasClean());
+  {
+    long n = 0, sum = 0;
+    for (PersistentPointer<Node> p = GCPersistentHeap::getRoot<Node>("list");
+         p; p = p->next, n++)
+      sum += p->value;
+    CHECK(n == 100 && sum == 4950);
+  }
+  CHECK(GCPersistentHeap::close());
+  unlink(path);
+  return 0;
+}
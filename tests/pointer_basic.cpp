@@ -0,0 +1,52 @@
+// Reference counting and collection of plain Pointers.
+#include "../gc_pointer.h"
+#include "check.h"
+
+struct Node {
+  int value;
+  Pointer<Node> next;
+};
+
+int main() {
+  {
+    Pointer<int> p = make_gc<int>(19);
+    Pointer<int> q = p;
+    CHECK(*q == 19);
+    CHECK(Pointer<int>::refContainerSize() == 1);
+    p = new int(21);
+    CHECK(*p == 21 && *q == 19);
+    CHECK(Pointer<int>::refContainerSize() == 2);
+    q = p;
+    Pointer<int>::collect();
+    CHECK(Pointer<int>::refContainerSize() == 1);
+  }
+  CHECK(Pointer<int>::refContainerSize() == 0);
+
+  // An array knows its length, and its Iters cover it.
+  {
+    Pointer<int> a = make_gc_array<int>(10);
+    int i = 0;
+    for (Iter<int> it = a.begin(); it != a.end(); it++)
+      *it = i++;
+    CHECK(a.end() - a.begin() == 10 && a[9] == 9);
+    Pointer<int, 4> b(new int[4]());
+    CHECK(b.end() - b.begin() == 4);
+  }
+  CHECK(Pointer<int>::refContainerSize() == 0);
+
+  // A chain is freed from its head, and a WeakPointer sees it go.
+  {
+    WeakPointer<Node> tail;
+    {
+      Pointer<Node> head = make_gc<Node>();
+      head->next = make_gc<Node>();
+      head->next->value = 2;
+      tail = head->next;
+      CHECK(!tail.expired() && tail.lock()->value == 2);
+    }
+    CHECK(tail.expired());
+  }
+  Pointer<Node>::collect();
+  CHECK(Pointer<Node>::refContainerSize() == 0);
+  return 0;
+}
@@ -0,0 +1,55 @@
+// Pointers converted to a base class share the entry of the derived
+// allocation, which is freed once its last reference goes, however it
+// goes: destruction, assignment from a raw pointer or from a Pointer.
+#include "../gc_pointer.h"
+#include "check.h"
+
+struct Base {
+  virtual ~Base() {}
+  int id = 0;
+};
+int destroyed = 0;
+struct Derived : Base {
+  ~Derived() { destroyed++; }
+};
+
+int main() {
+  Pointer<Base> plain = make_gc<Base>();
+  {
+    Pointer<Base> b = make_gc<Derived>();
+    CHECK(destroyed == 0);
+    b = static_cast<Base *>(nullptr);
+    CHECK(destroyed == 1);
+
+    b = make_gc<Derived>();
+    b = plain;
+    CHECK(destroyed == 2);
+
+    b = make_gc<Derived>();
+    Pointer<Base> c = b;
+    b = plain;
+    CHECK(destroyed == 2);
+  }
+  CHECK(destroyed == 3);
+  CHECK(Pointer<Derived>::refContainerSize() == 0);
+
+  // A Pointer may be assigned one that lives in the block it lets go of.
+  struct Link : Base {
+    Pointer<Base> next;
+  };
+  {
+    Pointer<Base> head = make_gc<Link>();
+    Pointer<Link> link = make_gc<Link>();
+    link->next = make_gc<Derived>();
+    head = link;
+    link = static_cast<Link *>(nullptr);
+    Pointer<Link> first = make_gc<Link>();
+    first->next = make_gc<Derived>();
+    first->next->id = 7;
+    Pointer<Base> walk = first;
+    first = static_cast<Link *>(nullptr);
+    walk = static_cast<Link &>(*walk).next;
+    CHECK(walk->id == 7 && destroyed == 3);
+  }
+  return 0;
+}
@@ -0,0 +1,11 @@
+// Without GC_QUIET, Pointer's destructor lists refContainer before and
+// after collecting; ctest matches the listing (see CMakeLists.txt).
+#include "../gc_pointer.h"
+
+int main() {
+  Pointer<int> p = make_gc<int>(19);
+  {
+    Pointer<int> q = make_gc<int>(35);
+  }
+  return *p == 19 ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+// With GC_THREAD_SAFE, threads share Pointers: they copy, assign and drop
+// them while making their own, and every block is freed exactly once.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+std::atomic<int> made(0), destroyed(0);
+
+struct Item {
+  int value;
+  explicit Item(int v) : value(v) { made++; }
+  ~Item() { destroyed++; }
+};
+
+int main() {
+  const int THREADS = 4, ROUNDS = 500;
+  Pointer<Item> shared = make_gc<Item>(-1);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; t++)
+    threads.emplace_back([&shared, t] {
+      Pointer<Item> mine;
+      for (int i = 0; i < ROUNDS; i++) {
+        Pointer<Item> copy = shared;
+        CHECK(copy->value == -1);
+        mine = make_gc<Item>(t * ROUNDS + i);
+        Pointer<Item> other = mine;
+        CHECK(other->value == t * ROUNDS + i);
+      }
+    });
+  for (std::thread &t : threads)
+    t.join();
+  Pointer<Item>::collect();
+  CHECK(made == THREADS * ROUNDS + 1);
+  CHECK(destroyed == THREADS * ROUNDS);
+  CHECK(Pointer<Item>::refContainerSize() == 1);
+  return 0;
+}
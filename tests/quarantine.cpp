@@ -0,0 +1,55 @@
+// With GC_QUARANTINE, collected blocks are filled with the poison byte and
+// held until drain(), and a write through a stale pointer is reported when
+// the block leaves the quarantine (ctest matches the report).
+#include "../gc_pointer.h"
+#include "check.h"
+#include <csignal>
+
+bool expectAbort = false;
+
+void aborted(int) { std::_Exit(expectAbort ? 0 : 1); }
+
+// Stale blocks are poisoned for AddressSanitizer too; the test reaches
+// into them on purpose.
+void reach(void *block, std::size_t bytes) {
+#ifdef GC_ASAN
+  ASAN_UNPOISON_MEMORY_REGION(block, bytes);
+#else
+  (void)block;
+  (void)bytes;
+#endif
+}
+
+int main() {
+  std::signal(SIGABRT, aborted);
+  Pointer<long> one = make_gc<long>(42);
+  Pointer<long> four = make_gc_array<long>(4);
+  long *stale = one, *staleArray = four;
+  one = static_cast<long *>(nullptr);
+  four = static_cast<long *>(nullptr);
+  CHECK(Pointer<long>::collect());
+  CHECK(GCQuarantine::size() == 2);
+  CHECK(GCQuarantine::bytes() == 5 * sizeof(long));
+  reach(stale, sizeof(long));
+  reach(staleArray, 4 * sizeof(long));
+  const unsigned char *bytes = reinterpret_cast<unsigned char *>(stale);
+  for (std::size_t i = 0; i < sizeof(long); i++)
+    CHECK(bytes[i] == GCQuarantine::POISON);
+  bytes = reinterpret_cast<unsigned char *>(staleArray);
+  for (std::size_t i = 0; i < 4 * sizeof(long); i++)
+    CHECK(bytes[i] == GCQuarantine::POISON);
+  GCQuarantine::drain();
+  CHECK(GCQuarantine::size() == 0 && GCQuarantine::bytes() == 0);
+
+  // Written after it was collected: draining reports it and aborts.
+  one = make_gc<long>(7);
+  stale = one;
+  one = static_cast<long *>(nullptr);
+  Pointer<long>::collect();
+  reach(stale, sizeof(long));
+  *stale = 8;
+  expectAbort = true;
+  GCQuarantine::drain();
+  CHECK(!"the write was not reported");
+  return 0;
+}
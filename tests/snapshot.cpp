@@ -0,0 +1,79 @@
+// Heap snapshots record each Pointer member as a strong edge and each
+// WeakPointer member as a weak one, whatever the member order, and also
+// for blocks compact() has moved.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <cstdio>
+#include <map>
+#include <vector>
+
+struct Node {
+  WeakPointer<Node> parent; // before the Pointer, on purpose
+  Pointer<Node> child;
+  int value;
+};
+struct Moved {
+  Pointer<Moved> next;
+  WeakPointer<Moved> self;
+};
+template <> struct GCRelocatable<Moved> : std::true_type {};
+
+typedef std::map<std::uint64_t, std::vector<std::uint64_t>> Edges;
+
+template <class V> bool get(std::FILE *in, V &v) {
+  return std::fread(&v, sizeof v, 1, in) == 1;
+}
+
+// Reads the edges of every block in a snapshot file.
+bool read(const char *path, Edges &edges) {
+  std::FILE *in = std::fopen(path, "rb");
+  if (!in)
+    return false;
+  char magic[8];
+  std::uint32_t version, check, types, length, u32;
+  bool ok = std::fread(magic, 8, 1, in) == 1 && get(in, version) &&
+            get(in, check) && get(in, types);
+  for (std::uint32_t t = 0; ok && t < types; t++)
+    ok = get(in, length) && std::fseek(in, length, SEEK_CUR) == 0;
+  for (;;) {
+    std::uint64_t addr, bytes, target;
+    std::uint32_t count;
+    ok = ok && get(in, addr) && get(in, bytes) && get(in, u32) &&
+         get(in, u32) && get(in, u32) && get(in, u32) && get(in, count);
+    if (!ok || addr == 0)
+      break;
+    std::vector<std::uint64_t> &out = edges[addr];
+    for (std::uint32_t e = 0; ok && e < count; e++)
+      if ((ok = get(in, target)))
+        out.push_back(target);
+  }
+  std::fclose(in);
+  return ok;
+}
+
+std::uint64_t strong(const void *p) { return (std::uintptr_t)p; }
+std::uint64_t weak(const void *p) { return (std::uintptr_t)p | 1; }
+
+int main() {
+  const char *path = "snapshot_test.gcsnap";
+  Pointer<Node> root = make_gc<Node>();
+  root->child = make_gc<Node>();
+  root->child->parent = root;
+  Pointer<Moved> a = make_gc<Moved>();
+  a->next = make_gc<Moved>();
+  a->next->self = a->next;
+  CHECK(Pointer<Moved>::compact() == 2);
+
+  CHECK(write_gc_snapshot(path));
+  Edges edges;
+  CHECK(read(path, edges));
+  std::remove(path);
+  Node *r = root, *c = root->child;
+  Moved *m = a, *n = a->next;
+  CHECK(edges.size() == 4);
+  CHECK(edges[strong(r)] == std::vector<std::uint64_t>{strong(c)});
+  CHECK(edges[strong(c)] == std::vector<std::uint64_t>{weak(r)});
+  CHECK(edges[strong(m)] == std::vector<std::uint64_t>{strong(n)});
+  CHECK(edges[strong(n)] == std::vector<std::uint64_t>{weak(n)});
+  return 0;
+}
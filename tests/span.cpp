@@ -0,0 +1,64 @@
+// Views of a Pointer's array: sub-views, strides, and the rows and
+// columns of a matrix see the right elements, and every checked access
+// past the end throws OutOfRangeExc.
+#include "../gc_pointer.h"
+#include "check.h"
+
+template <class F> bool throws(F f) {
+  try {
+    f();
+  } catch (OutOfRangeExc &) {
+    return true;
+  }
+  return false;
+}
+
+int main() {
+  Pointer<int> a = make_gc_array<int>(12);
+  for (int i = 0; i < 12; i++)
+    a[i] = i;
+
+  Span<int> s = a.span();
+  CHECK(s.size() == 12 && s.data() == (int *)a && !s.empty());
+  int sum = 0;
+  for (int v : s)
+    sum += v;
+  CHECK(sum == 66 && s.at(11) == 11);
+  Span<int> mid = s.subspan(3, 4);
+  CHECK(mid.size() == 4 && mid[0] == 3 && mid.at(3) == 6);
+  CHECK(s.first(2)[1] == 1 && s.last(2)[0] == 10);
+  CHECK(s.subspan(12, 0).empty());
+  CHECK(throws([&] { s.at(12); }));
+  CHECK(throws([&] { s.subspan(13, 0); }));
+  CHECK(throws([&] { s.subspan(10, 3); }));
+  CHECK(throws([&] { s.first(13); }));
+  CHECK(throws([&] { s.last(13); }));
+
+  StridedSpan<int> odd = s.subspan(1, 11).stride(2);
+  CHECK(odd.size() == 6 && odd.stride() == 2);
+  CHECK(odd[0] == 1 && odd.at(5) == 11);
+  CHECK(s.stride(5).size() == 3 && s.stride(5)[2] == 10);
+  CHECK(throws([&] { odd.at(6); }));
+  CHECK(throws([&] { s.stride(0); }));
+
+  // 3 x 4, row-major.
+  Span2D<int> m = a.span2d(3, 4);
+  CHECK(m.rows() == 3 && m.cols() == 4 && m.size() == 12);
+  CHECK(m(1, 2) == 6 && m.at(2, 3) == 11);
+  Span<int> row = m.row(2);
+  CHECK(row.size() == 4 && row[0] == 8);
+  StridedSpan<int> col = m.column(1);
+  CHECK(col.size() == 3 && col.stride() == 4 && col[2] == 9);
+  col[0] = -1;
+  CHECK(a[1] == -1 && m.flat().size() == 12);
+  CHECK(throws([&] { m.at(3, 0); }));
+  CHECK(throws([&] { m.at(0, 4); }));
+  CHECK(throws([&] { m.row(3); }));
+  CHECK(throws([&] { m.column(4); }));
+  CHECK(throws([&] { a.span2d(4, 4); }));
+
+  // A single object is a view of one.
+  Pointer<int> one = make_gc<int>(5);
+  CHECK(one.span().size() == 1 && one.span()[0] == 5);
+  return 0;
+}
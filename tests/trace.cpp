@@ -0,0 +1,59 @@
+// With GC_TRACE, a collection records nested, matched begin and end events
+// for the collection, its sweeps and the batches it frees, then the
+// refContainer counter, and GCTrace::dump() writes them all.
+#include "../gc_pointer.h"
+#include "check.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+int main() {
+  const char *path = "trace_test.json";
+  Pointer<int> kept = make_gc<int>(1);
+  Pointer<int> dropped = make_gc<int>(2);
+  dropped = static_cast<int *>(nullptr);
+  unsigned long long before = GCTrace::recorded();
+  CHECK(Pointer<int>::collect());
+  CHECK(GCTrace::recorded() > before);
+  CHECK(GCTrace::dump(path));
+
+  std::FILE *in = std::fopen(path, "r");
+  CHECK(in);
+  std::vector<std::string> open;
+  int collects = 0, finalizes = 0, counters = 0;
+  char line[1024];
+  while (std::fgets(line, sizeof line, in)) {
+    const char *name = std::strstr(line, "{\"name\":\"");
+    const char *phase = std::strstr(line, "\"ph\":\"");
+    if (!name || !phase)
+      continue;
+    name += 9;
+    std::string event(name, std::strchr(name, '"') - name);
+    switch (phase[6]) {
+    case 'B':
+      open.push_back(event);
+      collects += event == "collect";
+      finalizes += event == "finalize";
+      break;
+    case 'E':
+      CHECK(!open.empty() && open.back() == event);
+      open.pop_back();
+      break;
+    case 'C':
+      // Recorded at the end of the collection, which left only kept.
+      CHECK(open.size() == 1 && open.back() == "collect");
+      CHECK(event.compare(0, 13, "refContainer ") == 0);
+      CHECK(std::strstr(line, "\"args\":{\"value\":1}"));
+      counters++;
+      break;
+    default:
+      CHECK(!"unknown phase");
+    }
+  }
+  std::fclose(in);
+  std::remove(path);
+  CHECK(open.empty());
+  CHECK(collects >= 1 && finalizes >= 1 && counters == collects);
+  return 0;
+}
@@ -0,0 +1,344 @@
+// Offline analyzer for heap snapshots from write_gc_snapshot() (see
+// gc_snapshot.h for the format). It prints the blocks and bytes per
+// type, the blocks retaining the most memory, and the top of the
+// dominator tree.
+//   gc_snapshot_analyze [-n top] [-d depth] <snapshot>
+// A block is a root when its reference count is higher than the number
+// of edges into it, that is when a Pointer outside the managed heap (on
+// the stack, in a global or in unmanaged memory) refers to it. A block A
+// dominates B when every path from the roots to B goes through A; B's
+// memory is retained by A, since freeing A's last outside reference
+// frees B too. The retained size of A is the size of all blocks it
+// dominates. Blocks no root reaches are kept alive only by cycles that
+// reference counting cannot reclaim, and are listed as leaked.
+//   g++ -std=c++17 -O2 tools/gc_snapshot_analyze.cpp
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+#include "../gc_snapshot.h"
+
+namespace {
+
+struct Block {
+  std::uint64_t addr;
+  std::uint64_t bytes;
+  std::uint32_t type;
+  std::uint32_t refCount;
+  std::uint32_t weakCount;
+  std::uint32_t flags;
+  std::vector<std::uint32_t> edges; // blocks its Pointers refer to
+  std::uint32_t inEdges;            // Pointers to it in managed blocks
+  std::uint32_t weakInEdges;        // WeakPointers to it in managed blocks
+  std::uint64_t retained;
+  std::uint32_t idom;    // immediate dominator, ROOT for the top level
+  std::uint32_t dominated; // blocks in its dominator subtree, itself included
+};
+
+const std::uint32_t NONE = 0xffffffff;
+
+struct Snapshot {
+  std::vector<std::string> types;
+  // blocks[0] is a virtual root with an edge to every root block.
+  std::vector<Block> blocks;
+};
+const std::uint32_t ROOT = 0;
+
+std::string demangle(const std::string &name) {
+#ifdef __GNUG__
+  int status = 0;
+  char *s = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+  if (status == 0 && s) {
+    std::string d(s);
+    std::free(s);
+    return d;
+  }
+#endif
+  return name;
+}
+
+bool get32(std::FILE *in, std::uint32_t &v) {
+  return std::fread(&v, sizeof(v), 1, in) == 1;
+}
+
+bool get64(std::FILE *in, std::uint64_t &v) {
+  return std::fread(&v, sizeof(v), 1, in) == 1;
+}
+
+bool load(const char *path, Snapshot &s) {
+  std::FILE *in = std::fopen(path, "rb");
+  if (!in) {
+    std::fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  char magic[8];
+  std::uint32_t version, check, types;
+  if (std::fread(magic, sizeof(magic), 1, in) != 1 ||
+      std::memcmp(magic, GCSnapshot::magic(), sizeof(magic)) != 0 ||
+      !get32(in, version) || !get32(in, check) || !get32(in, types)) {
+    std::fprintf(stderr, "%s is not a heap snapshot\n", path);
+    std::fclose(in);
+    return false;
+  }
+  if (version != GCSnapshot::VERSION || check != GCSnapshot::CHECK) {
+    std::fprintf(stderr, "%s: unsupported version or byte order\n", path);
+    std::fclose(in);
+    return false;
+  }
+  bool ok = true;
+  for (std::uint32_t t = 0; ok && t < types; t++) {
+    std::uint32_t length;
+    ok = get32(in, length);
+    std::string name(ok ? length : 0, '\0');
+    ok = ok && (length == 0 || std::fread(&name[0], 1, length, in) == length);
+    s.types.push_back(demangle(name));
+  }
+  s.blocks.push_back(Block());
+  s.blocks[ROOT].type = NONE;
+  std::vector<std::vector<std::uint64_t>> targets(1);
+  while (ok) {
+    Block b = Block();
+    std::uint32_t edges;
+    ok = get64(in, b.addr) && get64(in, b.bytes) && get32(in, b.type) &&
+         get32(in, b.refCount) && get32(in, b.weakCount) &&
+         get32(in, b.flags) && get32(in, edges);
+    if (!ok || b.addr == 0)
+      break;
+    std::vector<std::uint64_t> to(edges);
+    for (std::uint32_t e = 0; ok && e < edges; e++)
+      ok = get64(in, to[e]);
+    if (b.type >= types)
+      ok = false;
+    s.blocks.push_back(std::move(b));
+    targets.push_back(std::move(to));
+  }
+  std::fclose(in);
+  if (!ok) {
+    std::fprintf(stderr, "%s is truncated or corrupt\n", path);
+    return false;
+  }
+  std::unordered_map<std::uint64_t, std::uint32_t> index;
+  for (std::uint32_t i = 1; i < s.blocks.size(); i++)
+    index[s.blocks[i].addr] = i;
+  for (std::uint32_t i = 1; i < s.blocks.size(); i++)
+    for (std::uint64_t to : targets[i]) {
+      auto it = index.find(to & ~(std::uint64_t)1);
+      if (it == index.end())
+        continue;
+      if (to & 1) {
+        s.blocks[it->second].weakInEdges++;
+        continue;
+      }
+      s.blocks[i].edges.push_back(it->second);
+      s.blocks[it->second].inEdges++;
+    }
+  for (std::uint32_t i = 1; i < s.blocks.size(); i++)
+    if (s.blocks[i].refCount > s.blocks[i].inEdges)
+      s.blocks[ROOT].edges.push_back(i);
+  return true;
+}
+
+// Dominators with the iterative algorithm of Cooper, Harvey and
+// Kennedy, "A Simple, Fast Dominance Algorithm", over a reverse
+// postorder from the virtual root. Unreachable blocks keep idom NONE.
+void dominators(Snapshot &s) {
+  std::size_t n = s.blocks.size();
+  std::vector<std::uint32_t> order; // postorder
+  std::vector<std::uint32_t> number(n, NONE);
+  std::vector<char> seen(n, 0);
+  // Iterative DFS: the stack holds a block and the next edge to follow.
+  std::vector<std::pair<std::uint32_t, std::size_t>> stack;
+  stack.push_back(std::make_pair(ROOT, 0));
+  seen[ROOT] = 1;
+  while (!stack.empty()) {
+    std::uint32_t b = stack.back().first;
+    std::size_t &e = stack.back().second;
+    if (e < s.blocks[b].edges.size()) {
+      std::uint32_t to = s.blocks[b].edges[e++];
+      if (!seen[to]) {
+        seen[to] = 1;
+        stack.push_back(std::make_pair(to, 0));
+      }
+    }
+    else {
+      number[b] = (std::uint32_t)order.size();
+      order.push_back(b);
+      stack.pop_back();
+    }
+  }
+  std::vector<std::vector<std::uint32_t>> preds(n);
+  for (std::uint32_t b : order)
+    for (std::uint32_t to : s.blocks[b].edges)
+      preds[to].push_back(b);
+  std::vector<std::uint32_t> idom(n, NONE);
+  idom[ROOT] = ROOT;
+  for (bool changed = true; changed;) {
+    changed = false;
+    // Reverse postorder, skipping the root (last in postorder).
+    for (std::size_t k = order.size() - 1; k-- > 0;) {
+      std::uint32_t b = order[k];
+      std::uint32_t d = NONE;
+      for (std::uint32_t p : preds[b]) {
+        if (idom[p] == NONE)
+          continue;
+        if (d == NONE) {
+          d = p;
+          continue;
+        }
+        std::uint32_t x = p, y = d;
+        while (x != y) {
+          while (number[x] < number[y])
+            x = idom[x];
+          while (number[y] < number[x])
+            y = idom[y];
+        }
+        d = x;
+      }
+      if (d != idom[b]) {
+        idom[b] = d;
+        changed = true;
+      }
+    }
+  }
+  // Postorder visits the dominated blocks before their dominators.
+  for (std::uint32_t b = 0; b < n; b++) {
+    s.blocks[b].idom = idom[b];
+    s.blocks[b].retained = s.blocks[b].bytes;
+    s.blocks[b].dominated = 1;
+  }
+  for (std::uint32_t b : order)
+    if (b != ROOT) {
+      Block &d = s.blocks[idom[b]];
+      d.retained += s.blocks[b].retained;
+      d.dominated += s.blocks[b].dominated;
+    }
+}
+
+const char *typeName(const Snapshot &s, std::uint32_t b) {
+  return s.types[s.blocks[b].type].c_str();
+}
+
+void printBlock(const Snapshot &s, std::uint32_t b, int indent) {
+  const Block &k = s.blocks[b];
+  std::printf("%*s0x%llx %s%s  retained %llu  shallow %llu  blocks %u"
+              "  refs %u/%u\n",
+              indent, "", (unsigned long long)k.addr, typeName(s, b),
+              (k.flags & GCSnapshot::ARRAY) ? "[]" : "",
+              (unsigned long long)k.retained, (unsigned long long)k.bytes,
+              k.dominated, k.refCount, k.inEdges);
+}
+
+void printTree(const Snapshot &s,
+               const std::vector<std::vector<std::uint32_t>> &children,
+               std::uint32_t b, int depth, int maxDepth, std::size_t top) {
+  const std::vector<std::uint32_t> &c = children[b];
+  for (std::size_t i = 0; i < c.size() && i < top; i++) {
+    printBlock(s, c[i], 2 * depth);
+    if (depth + 1 < maxDepth)
+      printTree(s, children, c[i], depth + 1, maxDepth, top);
+  }
+  if (c.size() > top)
+    std::printf("%*s... %zu more\n", 2 * depth, "", c.size() - top);
+}
+
+void report(Snapshot &s, std::size_t top, int depth) {
+  std::size_t n = s.blocks.size();
+  struct TypeTotals {
+    std::uint64_t blocks, bytes, leakedBlocks, leakedBytes;
+  };
+  std::vector<TypeTotals> types(s.types.size(), TypeTotals());
+  std::uint64_t bytes = 0, edges = 0, weakEdges = 0, leaked = 0;
+  std::uint64_t leakedBytes = 0;
+  for (std::uint32_t b = 1; b < n; b++) {
+    const Block &k = s.blocks[b];
+    bytes += k.bytes;
+    edges += k.edges.size();
+    weakEdges += k.weakInEdges;
+    types[k.type].blocks++;
+    types[k.type].bytes += k.bytes;
+    if (k.idom == NONE) {
+      leaked++;
+      leakedBytes += k.bytes;
+      types[k.type].leakedBlocks++;
+      types[k.type].leakedBytes += k.bytes;
+    }
+  }
+  std::printf("blocks %zu  bytes %llu  edges %llu (and %llu weak)  roots %zu"
+              "  leaked %llu (%llu bytes)\n\n",
+              n - 1, (unsigned long long)bytes, (unsigned long long)edges,
+              (unsigned long long)weakEdges,
+              s.blocks[ROOT].edges.size(), (unsigned long long)leaked,
+              (unsigned long long)leakedBytes);
+
+  std::vector<std::uint32_t> byType(types.size());
+  for (std::uint32_t t = 0; t < types.size(); t++)
+    byType[t] = t;
+  std::sort(byType.begin(), byType.end(), [&](std::uint32_t a, std::uint32_t b) {
+    return types[a].bytes > types[b].bytes;
+  });
+  std::printf("%12s %14s %12s %14s  type\n", "blocks", "bytes", "leaked",
+              "leaked bytes");
+  for (std::uint32_t t : byType)
+    if (types[t].blocks)
+      std::printf("%12llu %14llu %12llu %14llu  %s\n",
+                  (unsigned long long)types[t].blocks,
+                  (unsigned long long)types[t].bytes,
+                  (unsigned long long)types[t].leakedBlocks,
+                  (unsigned long long)types[t].leakedBytes,
+                  s.types[t].c_str());
+
+  // Largest retained sizes first.
+  std::vector<std::uint32_t> reachable;
+  for (std::uint32_t b = 1; b < n; b++)
+    if (s.blocks[b].idom != NONE)
+      reachable.push_back(b);
+  auto byRetained = [&](std::uint32_t a, std::uint32_t b) {
+    return s.blocks[a].retained > s.blocks[b].retained;
+  };
+  std::sort(reachable.begin(), reachable.end(), byRetained);
+  std::printf("\ntop retainers (refs: count/from managed blocks)\n");
+  for (std::size_t i = 0; i < reachable.size() && i < top; i++)
+    printBlock(s, reachable[i], 2);
+
+  std::vector<std::vector<std::uint32_t>> children(n);
+  for (std::uint32_t b : reachable)
+    children[s.blocks[b].idom].push_back(b);
+  std::printf("\ndominator tree (depth %d)\n", depth);
+  printTree(s, children, ROOT, 1, depth + 1, top);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::size_t top = 20;
+  int depth = 3;
+  const char *path = nullptr;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (!std::strcmp(argv[i], "-n") && i + 1 < argc)
+      top = std::strtoul(argv[++i], nullptr, 10);
+    else if (!std::strcmp(argv[i], "-d") && i + 1 < argc)
+      depth = std::atoi(argv[++i]);
+    else if (!path)
+      path = argv[i];
+    else
+      usage = true;
+  }
+  if (!path || usage) {
+    std::fprintf(stderr, "usage: %s [-n top] [-d depth] <snapshot>\n", argv[0]);
+    return 2;
+  }
+  Snapshot s;
+  if (!load(path, s))
+    return 1;
+  dominators(s);
+  report(s, top, depth);
+  return 0;
+}